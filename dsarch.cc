@@ -3,10 +3,17 @@
 #include <sstream>
 #include <vector>
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
 
 #include <boost/core/demangle.hpp>
 
+#include <sys/mman.h>
+
 #include "dsarch.hh"
+#include "dsarch_trace.hh"
 
 namespace dsarch {
 
@@ -29,7 +36,7 @@ std::string named::anon(named const * ptr)
 }
 
 host::host(network* n, bool _b) 
-: _net(n), _addr(unknown_addr), _mcast(_b)
+: _net(n), _addr(unknown_addr), _index(no_index), _mcast(_b)
 {
 	if(!_mcast) {
 		_net->_hosts.insert(this);
@@ -45,8 +52,10 @@ host::host(network* n)
 host::~host()
 { 
 	// nullify incoming channels
-	for(auto c: _incoming)
+	for(auto c: _incoming) {
+		_net->_chan_index.erase(channel_key{c->src, c->dst, c->rpcc});
 		c->dst = nullptr;
+	}
 
 	// remove from network
 	if(!_mcast) {
@@ -93,6 +102,17 @@ host_group::host_group(network* n)
 : host(n, true)
 { }
 
+void network::all_hosts_group::count_deliveries(host* sender, 
+	channel_counters& c, size_t msg_size)
+{
+	for(host* h : net()->_hosts)
+		if(h != sender) {
+			traffic_totals& t = c.host_totals(h->index());
+			t.rxmsgs++;
+			t.rxbyts += msg_size;
+		}
+}
+
 
 
 //-------------------
@@ -103,8 +123,197 @@ host_group::host_group(network* n)
 
 
 
+channel_counters::channel_counters() { }
+
+channel_counters::~channel_counters() { }
+
+size_t channel_counters::grow()
+{
+	msgs.push_back(0);
+	byts.push_back(0);
+	rxmsgs.push_back(0);
+	rxbyts.push_back(0);
+	return msgs.size()-1;
+}
+
+void channel_counters::reserve_slots(size_t n)
+{
+	if(n > msgs.size()) {
+		msgs.resize(n, 0);
+		byts.resize(n, 0);
+		rxmsgs.resize(n, 0);
+		rxbyts.resize(n, 0);
+	}
+}
+
+void channel_counters::merge_shards()
+{
+	shards->merge_into(*this);
+}
+
+void channel_counters::clear(size_t cid)
+{
+	msgs[cid] = byts[cid] = rxmsgs[cid] = rxbyts[cid] = 0;
+}
+
+void channel_counters::clear(size_t cid, rpcc_t endp)
+{
+	if(msgs[cid] != 0) {
+		traffic_totals t { msgs[cid], byts[cid], rxmsgs[cid], rxbyts[cid] };
+		by_endp[endp] -= t;
+		by_ifc[endp >> RPCC_BITS_PER_IFC] -= t;
+	}
+	clear(cid);
+}
+
+void channel_counters::grow_totals(rpcc_t endp)
+{
+	by_endp.resize(endp+1);
+	size_t nifc = (endp >> RPCC_BITS_PER_IFC) + 1;
+	if(nifc > by_ifc.size())
+		by_ifc.resize(nifc);
+}
+
+size_t channel_counters::sum(const vector<size_t>& col)
+{
+	size_t ret = 0;
+	const size_t n = col.size();
+	const size_t* c = col.data();
+	for(size_t i=0; i<n; i++) ret += c[i];
+	return ret;
+}
+
+
+static std::atomic<size_t> __shards_serial { 0 };
+
+counter_shards::counter_shards()
+: serial(++__shards_serial)
+{ }
+
+counter_shards::shard* counter_shards::register_thread()
+{
+	// shards of other networks this thread has used
+	thread_local unordered_map<size_t, shard*> known;
+	auto it = known.find(serial);
+	if(it != known.end())
+		return it->second;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	shards.emplace_back(new shard);
+	known[serial] = shards.back().get();
+	return shards.back().get();
+}
+
+void counter_shards::merge_into(channel_counters& main)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for(auto& sh : shards) {
+		if(! sh->dirty) continue;
+		channel_counters& c = sh->ctr;
+		const size_t n = std::min(c.size(), main.size());
+		for(size_t i=0; i<n; i++) main.msgs[i] += c.msgs[i];
+		for(size_t i=0; i<n; i++) main.byts[i] += c.byts[i];
+		for(size_t i=0; i<n; i++) main.rxmsgs[i] += c.rxmsgs[i];
+		for(size_t i=0; i<n; i++) main.rxbyts[i] += c.rxbyts[i];
+		std::fill(c.msgs.begin(), c.msgs.end(), 0);
+		std::fill(c.byts.begin(), c.byts.end(), 0);
+		std::fill(c.rxmsgs.begin(), c.rxmsgs.end(), 0);
+		std::fill(c.rxbyts.begin(), c.rxbyts.end(), 0);
+
+		if(! c.by_endp.empty()) {
+			main.grow_totals(c.by_endp.size()-1);
+			for(size_t i=0; i<c.by_endp.size(); i++) main.by_endp[i] += c.by_endp[i];
+			for(size_t i=0; i<c.by_ifc.size(); i++) main.by_ifc[i] += c.by_ifc[i];
+			std::fill(c.by_endp.begin(), c.by_endp.end(), traffic_totals());
+			std::fill(c.by_ifc.begin(), c.by_ifc.end(), traffic_totals());
+		}
+		main.reserve_hosts(c.by_host.size());
+		for(size_t i=0; i<c.by_host.size(); i++) main.by_host[i] += c.by_host[i];
+		std::fill(c.by_host.begin(), c.by_host.end(), traffic_totals());
+		sh->dirty = false;
+	}
+}
+
+
+traffic_windows::traffic_windows(size_t nwindows)
+: W(nwindows)
+{
+	if(W == 0)
+		throw std::invalid_argument("the number of windows must be positive");
+}
+
+
+size_t* traffic_windows::ring(size_t cid)
+{
+	if(cid >= rings.size())
+		rings.resize(cid+1);
+	auto& r = rings[cid];
+	if(! r) {
+		r.reset(new size_t[1+2*W]());
+		r[0] = cur;
+	} else if(r[0] != cur) {
+		// zero the slots of the epochs skipped since the last transmit
+		size_t* p = r.get();
+		for(size_t e = p[0]+1; e <= cur && e <= p[0]+W; e++)
+			p[1 + e%W] = p[1 + W + e%W] = 0;
+		p[0] = cur;
+	}
+	return r.get();
+}
+
+
+void traffic_windows::clear(size_t cid)
+{
+	if(cid < rings.size())
+		rings[cid].reset();
+}
+
+
+size_t traffic_windows::msgs(size_t cid, size_t from, size_t to) const
+{
+	size_t ret = 0;
+	if(from + W < cur + 1) from = cur + 1 - W;
+	for(size_t e = from; e < to && e <= cur; e++) ret += msgs(cid, e);
+	return ret;
+}
+
+
+size_t traffic_windows::bytes(size_t cid, size_t from, size_t to) const
+{
+	size_t ret = 0;
+	if(from + W < cur + 1) from = cur + 1 - W;
+	for(size_t e = from; e < to && e <= cur; e++) ret += bytes(cid, e);
+	return ret;
+}
+
+
+void channel_attrs::set(size_t cid, host_addr s, host_addr d, rpcc_t r, bool m)
+{
+	if(cid >= src.size()) {
+		// columns are padded to a multiple of 64, so that 
+		// chan_query kernels can process complete words
+		size_t n = ((cid>>6)+1)<<6;
+		src.resize(n, unknown_addr);
+		dst.resize(n, unknown_addr);
+		rpcc.resize(n, 0);
+		mcast.resize(n, 0);
+		live.resize(n>>6, 0);
+	}
+	src[cid] = s;
+	dst[cid] = d;
+	rpcc[cid] = r;
+	mcast[cid] = m;
+	live[cid>>6] |= uint64_t(1) << (cid&63);
+}
+
+void channel_attrs::clear(size_t cid)
+{
+	live[cid>>6] &= ~(uint64_t(1) << (cid&63));
+}
+
+
 channel::channel(host* _src, host* _dst, rpcc_t _rpcc) 
-	: src(_src), dst(_dst), rpcc(_rpcc), msgs(0), byts(0) 
+	: src(_src), dst(_dst), rpcc(_rpcc), cid(0), ctr(nullptr)
 {  }
 
 channel::~channel()
@@ -114,34 +323,59 @@ channel::~channel()
 
 void channel::transmit(size_t msg_size)
 {
-	msgs++;
-	byts += msg_size;
+	channel_counters& c = ctr->local(cid);
+	c.msgs[cid]++;
+	c.byts[cid] += msg_size;
+	c.count_endp(rpcc, 1, msg_size);
+	traffic_totals& s = c.host_totals(src->index());
+	s.msgs++;
+	s.byts += msg_size;
+	if(dst && ! dst->is_mcast()) {
+		traffic_totals& d = c.host_totals(dst->index());
+		d.rxmsgs++;
+		d.rxbyts += msg_size;
+	}
+	if(ctr->windows)
+		ctr->windows->record(cid, msg_size);
+	if(ctr->trace)
+		ctr->trace->record(cid, msg_size);
 }
 
 
 multicast_channel::multicast_channel(host *s, host_group* d, rpcc_t rpcc)
-	: channel(s,d,rpcc), rxmsgs(0), rxbyts(0)
+	: channel(s,d,rpcc)
 {
 }
 
 
-size_t multicast_channel::messages_received() const { return rxmsgs; }
+size_t multicast_channel::messages_received() const 
+{ 
+	ctr->sync(); 
+	return ctr->rxmsgs[cid]; 
+}
 
-size_t multicast_channel::bytes_received() const { return rxbyts; }
+size_t multicast_channel::bytes_received() const 
+{ 
+	ctr->sync(); 
+	return ctr->rxbyts[cid]; 
+}
 
 void multicast_channel::transmit(size_t msg_size)
 {
 	channel::transmit(msg_size);
 	size_t gsize = static_cast<host_group*>(dst)->receivers(src);
-	rxmsgs += gsize;
-	rxbyts += gsize*msg_size;
+	channel_counters& c = ctr->local(cid);
+	c.rxmsgs[cid] += gsize;
+	c.rxbyts[cid] += gsize*msg_size;
+	c.count_endp(rpcc, 0, 0, gsize, gsize*msg_size);
+	static_cast<host_group*>(dst)->count_deliveries(src, c, msg_size);
 }
 
 
 string channel::repr() const {
 	ostringstream ss;
 	ss << "[chan " << src->addr() << "->" << dst->addr() << " traffic:"
-		<< msgs << "," << byts << "]";
+		<< messages() << "," << bytes() << "]";
 	ss.flush();
 	return ss.str();
 }
@@ -149,7 +383,8 @@ string channel::repr() const {
 string multicast_channel::repr() const {
 	ostringstream ss;
 	ss << "[chan " << src->addr() << "->" << dst->addr() << " traffic:"
-		<< msgs << "(" << rxmsgs <<  ")," << byts << "(" << rxbyts << ")]";
+		<< messages() << "(" << messages_received() <<  ")," 
+		<< bytes() << "(" << bytes_received() << ")]";
 	ss.flush();
 	return ss.str();
 }
@@ -162,12 +397,30 @@ string multicast_channel::repr() const {
 //-------------------
 
 
+// the default channels are allocated in the arena
+static_assert(sizeof(multicast_channel) == sizeof(channel),
+	"multicast channels must fit in channel slots");
+
 channel* network::create_channel(host* src, host* dst, rpcc_t endp) const
 {
+	void* p = _arena.allocate(sizeof(channel));
+	channel* chan;
 	if(dst->is_mcast())
-		return new multicast_channel(src, static_cast<host_group*>(dst), endp);
+		chan = new (p) multicast_channel(src, static_cast<host_group*>(dst), endp);
 	else
-	 	return new channel(src, dst, endp);	
+	 	chan = new (p) channel(src, dst, endp);
+	chan->pooled = true;
+	return chan;
+}
+
+
+void network::free_channel(channel* c)
+{
+	if(c->pooled) {
+		c->~channel();
+		_arena.deallocate(c, sizeof(channel));
+	} else
+		delete c;
 }
 
 
@@ -175,10 +428,10 @@ channel* network::create_channel(host* src, host* dst, rpcc_t endp) const
 channel* network::connect(host* src, host* dst, rpcc_t endp)
 {
 	// check for existing channel
-	for(auto chan : dst->_incoming) {
-		assert(chan->dst == dst);
-		if(chan->src == src && chan->rpcc==endp)
-			return chan;
+	auto it = _chan_index.find(channel_key{src, dst, endp});
+	if(it != _chan_index.end()) {
+		assert(it->second->dst == dst);
+		return it->second;
 	}
 
 	if(src->is_mcast())
@@ -190,8 +443,21 @@ channel* network::connect(host* src, host* dst, rpcc_t endp)
 	// create new channel
 	channel* chan = create_channel(src, dst, endp);
 
+	// assign a dense id
+	if(_free_cids.empty()) {
+		chan->cid = _counters.grow();
+		_chan_by_id.push_back(chan);
+	} else {
+		chan->cid = _free_cids.back();
+		_free_cids.pop_back();
+		_chan_by_id[chan->cid] = chan;
+	}
+	chan->ctr = &_counters;
+	_attrs.set(chan->cid, src->addr(), dst->addr(), endp, dst->is_mcast());
+
 	// add it to places
 	_channels.insert(chan);
+	_chan_index.emplace(channel_key{src, dst, endp}, chan);
 	dst->_incoming.insert(chan);
 
 	return chan;
@@ -201,9 +467,18 @@ channel* network::connect(host* src, host* dst, rpcc_t endp)
 void network::disconnect(channel* c)
 {
 	_channels.erase(c);
-	if(c->dst)
+	if(c->dst) {
+		_chan_index.erase(channel_key{c->src, c->dst, c->rpcc});
 		c->dst->_incoming.erase(c);
-	delete c;
+	}
+	_counters.sync();
+	_counters.clear(c->cid, c->rpcc);
+	if(_counters.windows)
+		_counters.windows->clear(c->cid);
+	_attrs.clear(c->cid);
+	_chan_by_id[c->cid] = nullptr;
+	_free_cids.push_back(c->cid);
+	free_channel(c);
 }
 
 rpcc_t network::decl_interface(const std::type_info& ti)
@@ -230,6 +505,127 @@ rpcc_t network::decl_method(rpcc_t ifc, const string& name, bool onew)
 
 
 
+void network::set_sharded_counters(bool enable)
+{
+	if(enable == sharded_counters()) return;
+	if(enable && _counters.windows)
+		throw std::logic_error("sharded counters cannot be combined with windows");
+	if(enable && _counters.trace)
+		throw std::logic_error("sharded counters cannot be combined with tracing");
+	if(enable)
+		_counters.shards.reset(new counter_shards());
+	else {
+		_counters.sync();
+		_counters.shards.reset();
+	}
+}
+
+
+const rpc_binding* network::bind_interface(rpcc_t ifc)
+{
+	auto& root = _bindings[ifc];
+	if(! root)
+		root.reset(new rpc_binding(ifc));
+	return root.get();
+}
+
+
+const rpc_binding* network::bind_method(const rpc_binding* b, const string& name,
+	bool one_way, rpc_binding::erased_method meth)
+{
+	for(auto& child : b->children) {
+		const rpc_binding::call& last = child->calls.back();
+		if(last.method == meth && last.one_way == one_way && last.name == name)
+			return child.get();
+	}
+
+	if(b->calls.size() == UINT16_MAX)
+		throw std::length_error("too many remote methods in proxy");
+	rpc_binding* child = new rpc_binding(b->ifc);
+	child->calls.reserve(b->calls.size()+1);
+	child->calls = b->calls;
+	child->calls.push_back(rpc_binding::call { 
+		decl_method(b->ifc, name, one_way), one_way, meth, name
+	});
+	b->children.emplace_back(child);
+	return child;
+}
+
+
+void network::set_lazy_channels(bool enable)
+{
+	if(enable && (_exec || _fanout))
+		throw std::logic_error("lazy channels cannot be combined with parallel execution");
+	_lazy = enable;
+}
+
+
+void network::set_windows(size_t nwindows)
+{
+	if(nwindows == 0) {
+		_counters.windows.reset();
+		return;
+	}
+	if(sharded_counters())
+		throw std::logic_error("windows cannot be combined with sharded counters");
+	_counters.windows.reset(new traffic_windows(nwindows));
+}
+
+
+void network::set_trace(trace_writer* tw)
+{
+	if(tw && sharded_counters())
+		throw std::logic_error("tracing cannot be combined with sharded counters");
+	if(_counters.trace)
+		_counters.trace->nw = nullptr;
+	_counters.trace = tw;
+	if(tw) {
+		if(tw->nw && tw->nw != this) tw->nw->set_trace(nullptr);
+		tw->nw = this;
+	}
+}
+
+
+void network::set_handler_profiling(bool enable)
+{
+	if(_exec || _fanout)
+		throw std::logic_error("handler profiling cannot be toggled while threads are attached");
+	_profile.reset(enable ? new handler_profile() : nullptr);
+}
+
+
+const time_histogram* network::handler_times(const string& ifname, 
+	const string& mname) const
+{
+	if(! _profile) return nullptr;
+	rpcc_t code = rpctab.code(ifname, mname);
+	return code ? _profile->method(code) : nullptr;
+}
+
+
+time_histogram network::handler_times(const string& ifname) const
+{
+	if(! _profile) return time_histogram();
+	rpcc_t code = rpctab.code(ifname);
+	return code ? _profile->interface(code) : time_histogram();
+}
+
+
+traffic_totals network::method_traffic(const string& ifname, 
+	const string& mname) const
+{
+	rpcc_t code = rpctab.code(ifname, mname);
+	return code ? method_traffic(code) : traffic_totals();
+}
+
+
+traffic_totals network::interface_traffic(const string& ifname) const
+{
+	rpcc_t code = rpctab.code(ifname);
+	return code ? interface_traffic(code) : traffic_totals();
+}
+
+
 network::network()
 : all_hosts(this)
 { 
@@ -256,6 +652,7 @@ bool network::assign_address(host* h, host_addr a)
 				// found it!
 				h->_addr = ap;
 				addr_map[ap] = h;
+				if(! h->is_mcast()) h->_index = new_host_index++;
 			}
 
 			ap += step;
@@ -268,6 +665,7 @@ bool network::assign_address(host* h, host_addr a)
 	if(addr_map.find(a)==addr_map.end()) {
 		h->_addr = a;
 		addr_map[a] = h;
+		if(! h->is_mcast()) h->_index = new_host_index++;
 		return true;
 	} else {
 		return false;
@@ -293,6 +691,1033 @@ host* network::by_addr(host_addr a) const
 
 network::~network()
 {	
+	// detach the trace writer, which may outlive the network
+	if(_counters.trace)
+		set_trace(nullptr);
+
+	// pooled channels are released with the arena
+	for(auto c : _channels)
+		if(! c->pooled) delete c;
+}
+
+
+
+//-------------------
+//
+//  slab arena
+//
+//-------------------
+
+
+slab_arena::~slab_arena()
+{
+	for(void* b : blocks)
+		munmap(b, block_size);
+}
+
+
+void slab_arena::refill(size_t c)
+{
+	const size_t sz = (c+1)*granule;
+	if(left < sz) {
+		// put the tail of the current block on the free lists
+		while(left >= granule) {
+			size_t k = std::min(class_of(left), nclasses-1);
+			if((k+1)*granule > left) k--;
+			deallocate(cur, (k+1)*granule);
+			cur += (k+1)*granule;
+			left -= (k+1)*granule;
+		}
+
+		void* b = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if(huge)
+			b = mmap(nullptr, block_size, PROT_READ|PROT_WRITE, 
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+		if(b == MAP_FAILED) {
+			b = mmap(nullptr, block_size, PROT_READ|PROT_WRITE, 
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if(b == MAP_FAILED)
+				throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+			if(huge)
+				madvise(b, block_size, MADV_HUGEPAGE);
+#endif
+		}
+		blocks.push_back(b);
+		cur = static_cast<char*>(b);
+		left = block_size;
+	}
+
+	// carve a batch of objects
+	for(size_t i=0; i<64 && left >= sz; i++) {
+		deallocate(cur, sz);
+		cur += sz;
+		left -= sz;
+	}
+}
+
+
+
+//-------------------
+//
+//  handler profiling
+//
+//-------------------
+
+
+double tick_clock::ns_per_tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	// calibrate over 10 msec, once
+	static const double ratio = []() {
+		typedef chrono::steady_clock clock;
+		auto t0 = clock::now();
+		uint64_t c0 = now();
+		while(clock::now() - t0 < chrono::milliseconds(10));
+		uint64_t c1 = now();
+		double ns = chrono::duration<double, nano>(clock::now() - t0).count();
+		return c1 > c0 ? ns / (c1 - c0) : 1.0;
+	}();
+	return ratio;
+#else
+	return 1.0;
+#endif
+}
+
+
+uint64_t time_histogram::quantile(double q) const
+{
+	if(n == 0) return 0;
+	uint64_t rank = std::max<uint64_t>(1, std::ceil(std::clamp(q, 0.0, 1.0) * n));
+	uint64_t seen = 0;
+	for(size_t b = 0; b < num_buckets; b++) {
+		seen += counts[b];
+		if(seen >= rank)
+			return std::clamp(bucket_high(b), lo, hi);
+	}
+	return hi;
+}
+
+
+void time_histogram::merge(const time_histogram& other)
+{
+	for(size_t b = 0; b < num_buckets; b++)
+		counts[b] += other.counts[b];
+	n += other.n;
+	sum += other.sum;
+	lo = std::min(lo, other.lo);
+	hi = std::max(hi, other.hi);
+}
+
+
+void time_histogram::clear()
+{
+	*this = time_histogram();
+}
+
+
+handler_profile::handler_profile()
+: ns_per_tick(tick_clock::ns_per_tick())
+{ }
+
+
+handler_profile::~handler_profile()
+{
+	for(auto& d : dir) {
+		segment* seg = d.load();
+		if(seg == nullptr) continue;
+		for(auto& h : seg->meth)
+			delete h.load();
+		delete seg;
+	}
+}
+
+
+time_histogram* handler_profile::create(rpcc_t endp)
+{
+	size_t i = endp >> RPCC_BITS_PER_IFC;
+	if(i >= max_interfaces) return nullptr;
+
+	// install the segment and the histogram, unless another thread did
+	segment* seg = dir[i].load(memory_order_acquire);
+	if(seg == nullptr) {
+		segment* fresh = new segment();
+		if(dir[i].compare_exchange_strong(seg, fresh, memory_order_acq_rel))
+			seg = fresh;
+		else
+			delete fresh;
+	}
+	auto& slot = seg->meth[(endp & RPCC_METH_MASK) >> 1];
+	time_histogram* h = slot.load(memory_order_acquire);
+	if(h == nullptr) {
+		time_histogram* fresh = new time_histogram();
+		if(slot.compare_exchange_strong(h, fresh, memory_order_acq_rel))
+			h = fresh;
+		else
+			delete fresh;
+	}
+	return h;
+}
+
+
+const time_histogram* handler_profile::method(rpcc_t endp) const
+{
+	size_t i = endp >> RPCC_BITS_PER_IFC;
+	if(i >= max_interfaces) return nullptr;
+	segment* seg = dir[i].load(memory_order_acquire);
+	if(seg == nullptr) return nullptr;
+	return seg->meth[(endp & RPCC_METH_MASK) >> 1].load(memory_order_acquire);
+}
+
+
+time_histogram handler_profile::interface(rpcc_t ifc) const
+{
+	time_histogram ret;
+	size_t i = ifc >> RPCC_BITS_PER_IFC;
+	segment* seg = (i < max_interfaces) ? dir[i].load(memory_order_acquire) : nullptr;
+	if(seg != nullptr)
+		for(auto& h : seg->meth)
+			if(const time_histogram* hp = h.load(memory_order_acquire))
+				ret.merge(*hp);
+	return ret;
+}
+
+
+void handler_profile::for_each(
+	const std::function<void(rpcc_t, const time_histogram&)>& func) const
+{
+	for(size_t i = 0; i < max_interfaces; i++) {
+		segment* seg = dir[i].load(memory_order_acquire);
+		if(seg == nullptr) continue;
+		for(size_t m = 0; m < methods; m++)
+			if(const time_histogram* h = seg->meth[m].load(memory_order_acquire))
+				func(rpcc_t(i << RPCC_BITS_PER_IFC) | rpcc_t(m << 1), *h);
+	}
+}
+
+
+
+//-------------------
+//
+//  columnar queries
+//
+//-------------------
+
+
+chan_columns::chan_columns(const network& nw)
+{
+	const channel_attrs& at = nw.attrs();
+	const channel_counters& ct = nw.counters();
+	slots = at.src.size();
+	live = at.live.data();
+	src = at.src.data();
+	dst = at.dst.data();
+	rpcc = at.rpcc.data();
+	mcast = at.mcast.data();
+	counters = ct.size();
+	msgs = ct.msgs.data();
+	byts = ct.byts.data();
+	rxmsgs = ct.rxmsgs.data();
+	rxbyts = ct.rxbyts.data();
+	rpc = &nw.rpc();
+}
+
+
+chan_query::chan_query(const network& _nw)
+: chan_query(chan_columns(_nw), &_nw)
+{ }
+
+
+chan_query::chan_query(const chan_columns& _cols, const network* _nw)
+: cols(_cols), nw(_nw), bits(_cols.live, _cols.live + (_cols.slots>>6))
+{ }
+
+
+template <typename T>
+chan_query chan_query::filter(const T* chan_columns::* col, 
+	T value, T mask) const
+{
+	const T* c = cols.*col;
+	const size_t nwords = bits.size();
+	vector<uint64_t> ret(nwords, 0);
+	for(size_t w=0; w<nwords; w++) {
+		uint64_t sel = bits[w];
+		if(sel==0) continue;
+		// branch-free evaluation of 64 channels
+		const T* cw = c + (w<<6);
+		uint64_t m = 0;
+		for(size_t k=0; k<64; k++)
+			m |= uint64_t((cw[k] & mask) == value) << k;
+		ret[w] = sel & m;
+	}
+	return chan_query(*this, std::move(ret));
+}
+
+template chan_query chan_query::filter<host_addr>(
+	const host_addr* chan_columns::*, host_addr, host_addr) const;
+template chan_query chan_query::filter<rpcc_t>(
+	const rpcc_t* chan_columns::*, rpcc_t, rpcc_t) const;
+template chan_query chan_query::filter<uint8_t>(
+	const uint8_t* chan_columns::*, uint8_t, uint8_t) const;
+
+
+chan_query chan_query::filter_addr(const host_addr* chan_columns::* col, 
+	const host_set& hs) const
+{
+	unordered_set<host_addr> addrs;
+	for(auto h : hs) addrs.insert(h->addr());
+
+	const host_addr* c = cols.*col;
+	vector<uint64_t> ret(bits.size(), 0);
+	for(size_t w=0; w<bits.size(); w++) {
+		uint64_t sel = bits[w];
+		while(sel) {
+			int k = __builtin_ctzll(sel);
+			sel &= sel-1;
+			if(addrs.count(c[(w<<6)+k]))
+				ret[w] |= uint64_t(1) << k;
+		}
+	}
+	return chan_query(*this, std::move(ret));
+}
+
+
+size_t chan_query::column_sum(const size_t* chan_columns::* col) const
+{
+	// over a live network, read the current (synced) counters
+	const chan_columns cur = nw ? chan_columns(*nw) : cols;
+	const size_t* c = cur.*col;
+	const size_t n = cur.counters;
+	size_t ret = 0;
+	for(size_t w=0; w<bits.size() && (w<<6)<n; w++) {
+		uint64_t sel = bits[w];
+		if(sel==0) continue;
+		const size_t base = w<<6;
+		const size_t len = std::min<size_t>(64, n-base);
+		// masked, branch-free sum
+		for(size_t k=0; k<len; k++)
+			ret += c[base+k] & (size_t(0) - ((sel>>k) & 1));
+	}
+	return ret;
+}
+
+
+size_t chan_query::size() const
+{
+	size_t ret = 0;
+	for(auto w : bits) ret += __builtin_popcountll(w);
+	return ret;
+}
+
+
+size_t chan_query::msgs(size_t from, size_t to) const
+{
+	const traffic_windows* tw = nw ? nw->windows() : nullptr;
+	if(tw == nullptr) return 0;
+	size_t ret = 0;
+	for(size_t w=0; w<bits.size(); w++) {
+		uint64_t sel = bits[w];
+		while(sel) {
+			int k = __builtin_ctzll(sel);
+			sel &= sel-1;
+			size_t cid = (w<<6)+k;
+			if(tw->active(cid)) ret += tw->msgs(cid, from, to);
+		}
+	}
+	return ret;
+}
+
+
+size_t chan_query::bytes(size_t from, size_t to) const
+{
+	const traffic_windows* tw = nw ? nw->windows() : nullptr;
+	if(tw == nullptr) return 0;
+	size_t ret = 0;
+	for(size_t w=0; w<bits.size(); w++) {
+		uint64_t sel = bits[w];
+		while(sel) {
+			int k = __builtin_ctzll(sel);
+			sel &= sel-1;
+			size_t cid = (w<<6)+k;
+			if(tw->active(cid)) ret += tw->bytes(cid, from, to);
+		}
+	}
+	return ret;
+}
+
+
+chan_frame chan_query::frame() const
+{
+	if(nw == nullptr)
+		throw std::logic_error("no channel objects behind this query");
+	chan_frame cf;
+	cf.reserve(size());
+	for(size_t w=0; w<bits.size(); w++) {
+		uint64_t sel = bits[w];
+		while(sel) {
+			int k = __builtin_ctzll(sel);
+			sel &= sel-1;
+			cf.push_back(nw->channel_by_id((w<<6)+k));
+		}
+	}
+	return cf;
+}
+
+
+chan_query chan_query::union_with(const chan_query& other) const
+{
+	assert(cols.src == other.cols.src);
+	vector<uint64_t> ret(std::max(bits.size(), other.bits.size()), 0);
+	for(size_t w=0; w<bits.size(); w++) ret[w] = bits[w];
+	for(size_t w=0; w<other.bits.size(); w++) ret[w] |= other.bits[w];
+	return chan_query(*this, std::move(ret));
+}
+
+
+chan_query chan_query::except(const chan_query& other) const
+{
+	assert(cols.src == other.cols.src);
+	vector<uint64_t> ret(bits);
+	const size_t n = std::min(bits.size(), other.bits.size());
+	for(size_t w=0; w<n; w++) ret[w] &= ~other.bits[w];
+	return chan_query(*this, std::move(ret));
+}
+
+
+
+//-------------------
+//
+//  hotspots
+//
+//-------------------
+
+
+hotspot_report network::hotspots(size_t k, bool by_bytes) const
+{
+	_counters.sync();
+	const vector<traffic_totals>& tot = _counters.by_host;
+
+	hotspot_report rep;
+	rep.by_bytes = by_bytes;
+	rep.hosts = _hosts.size();
+	if(rep.hosts == 0) return rep;
+
+	vector<hotspot_report::entry> all;
+	all.reserve(rep.hosts);
+	for(host* h : _hosts) {
+		host_addr a = h->_addr;
+		traffic_totals t;
+		if(h->_index < tot.size()) t = tot[h->_index];
+		size_t load = by_bytes ? t.byts + t.rxbyts : t.msgs + t.rxmsgs;
+		all.push_back({ h, a, t, load });
+	}
+
+	// the loads in ascending order, for the quantiles and Gini
+	vector<size_t> load(all.size());
+	for(size_t i=0; i<all.size(); i++) load[i] = all[i].load;
+	std::sort(load.begin(), load.end());
+
+	const size_t n = load.size();
+	double sum = 0.0, sumsq = 0.0, wsum = 0.0;
+	for(size_t i=0; i<n; i++) {
+		double x = load[i];
+		sum += x;
+		sumsq += x*x;
+		wsum += (i+1)*x;
+	}
+	rep.total = std::accumulate(load.begin(), load.end(), size_t(0));
+	rep.min = load.front();
+	rep.max = load.back();
+	rep.median = load[n/2];
+	rep.mean = sum/n;
+	rep.stddev = std::sqrt(std::max(0.0, sumsq/n - rep.mean*rep.mean));
+	if(sum > 0) {
+		rep.imbalance = rep.max/rep.mean;
+		rep.gini = 2.0*wsum/(n*sum) - double(n+1)/n;
+	}
+
+	// the top k, ties broken by address
+	k = std::min(k, n);
+	auto heavier = [](const hotspot_report::entry& x, 
+		const hotspot_report::entry& y) {
+		return x.load > y.load || (x.load == y.load && x.addr < y.addr);
+	};
+	std::partial_sort(all.begin(), all.begin()+k, all.end(), heavier);
+	all.resize(k);
+	rep.top = std::move(all);
+
+	size_t topload = 0;
+	for(auto& e : rep.top) topload += e.load;
+	if(rep.total > 0)
+		rep.top_share = double(topload)/rep.total;
+	return rep;
+}
+
+
+string hotspot_report::repr() const
+{
+	ostringstream ss;
+	const char* unit = by_bytes ? "bytes" : "msgs";
+	ss << "hosts: " << hosts << "  total " << unit << ": " << total << "\n"
+		<< "load min/median/max: " << min << "/" << median << "/" << max
+		<< "  mean: " << mean << "  stddev: " << stddev << "\n"
+		<< "imbalance: " << imbalance << "  gini: " << gini 
+		<< "  top " << top.size() << " share: " << top_share << "\n";
+	ss << "addr\tload\tsent msgs\tsent bytes\trecv msgs\trecv bytes\n";
+	for(auto& e : top)
+		ss << e.addr << "\t" << e.load << "\t" << e.traffic.msgs << "\t"
+			<< e.traffic.byts << "\t" << e.traffic.rxmsgs << "\t" 
+			<< e.traffic.rxbyts << "\n";
+	return ss.str();
+}
+
+
+
+//-------------------
+//
+//  executor
+//
+//-------------------
+
+// the executor and worker index of the current thread
+static thread_local executor* __current_exec = nullptr;
+static thread_local size_t __current_worker = 0;
+
+// helper threads have no worker index
+static const size_t no_worker = size_t(-1);
+
+namespace {
+
+/*
+	The hosts whose tasks are running on the current thread, innermost
+	first. A call posted to another thread carries the chain of its 
+	caller, since the hosts of the chain are waiting for it and can be
+	called back.
+  */
+struct exec_frame
+{
+	host_mailbox* mb;
+	const exec_frame* parent;
+};
+
+thread_local const exec_frame* __current_frame = nullptr;
+
+// run a task in a frame of the current thread
+struct frame_guard
+{
+	exec_frame f;
+	const exec_frame* saved;
+	frame_guard(host_mailbox* mb, const exec_frame* parent)
+	: f { mb, parent }, saved(__current_frame) { __current_frame = &f; }
+	~frame_guard() { __current_frame = saved; }
+};
+
+}  // end anonymous namespace
+
+
+executor::executor(network* _nw, size_t nthreads)
+: nw(_nw)
+{
+	if(nw->_exec != nullptr)
+		throw std::logic_error("The network already has an executor");
+	if(nw->_sim != nullptr)
+		throw std::logic_error("The network is driven by a simulator");
+	if(nw->_lazy)
+		throw std::logic_error("The network has lazy channels");
+	if(nthreads==0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+	nw->set_sharded_counters(true);
+	nw->_exec = this;
+
+	for(size_t i=0; i<nthreads; i++)
+		workers.emplace_back(new worker);
+	for(size_t i=0; i<nthreads; i++)
+		workers[i]->thread = std::thread([this,i]() { run(i); });
+}
+
+
+executor::~executor()
+{
+	try {
+		wait();
+	} catch(...) { }
+
+	{
+		std::lock_guard<std::mutex> lock(idle_mtx);
+		stopping = true;
+	}
+	idle_cv.notify_all();
+	for(auto& w : workers)
+		w->thread.join();
+	for(auto& th : helpers)
+		th.join();
+
+	// detach from the network
+	for(auto h : nw->hosts())
+		h->_mbox.store(nullptr);
+	nw->_exec = nullptr;
+}
+
+
+host_mailbox* executor::mailbox(host* h)
+{
+	host_mailbox* mb = h->_mbox.load(std::memory_order_acquire);
+	if(mb) return mb;
+
+	std::lock_guard<std::mutex> lock(mbox_mtx);
+	mb = h->_mbox.load(std::memory_order_relaxed);
+	if(mb == nullptr) {
+		mailboxes.emplace_back(new host_mailbox);
+		mb = mailboxes.back().get();
+		h->_mbox.store(mb, std::memory_order_release);
+	}
+	return mb;
+}
+
+
+void executor::post(host* h, task&& t)
+{
+	host_mailbox* mb = mailbox(h);
+	pending++;
+
+	bool sched;
+	{
+		std::lock_guard<std::mutex> lock(mb->mtx);
+		mb->tasks.push_back(std::move(t));
+		sched = ! mb->scheduled;
+		mb->scheduled = true;
+	}
+	if(sched) schedule(mb);
+}
+
+
+void executor::call(host* h, const task& t)
+{
+	host_mailbox* mb = mailbox(h);
+	const exec_frame* caller = __current_frame;
+
+	// a host of the calling chain is waiting for us: a nested call
+	for(const exec_frame* f = caller; f; f = f->parent)
+		if(f->mb == mb) {
+			frame_guard g(mb, caller);
+			t();
+			return;
+		}
+
+	// an idle host is claimed, and runs on this thread
+	{
+		std::unique_lock<std::mutex> lock(mb->mtx);
+		if(! mb->scheduled) {
+			mb->scheduled = true;
+			lock.unlock();
+			try {
+				frame_guard g(mb, caller);
+				t();
+			} catch(...) {
+				release(mb);
+				throw;
+			}
+			release(mb);
+			return;
+		}
+	}
+
+	// else, post the call and wait
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool done = false;
+	std::exception_ptr err;
+	post(h, [&]() {
+		try {
+			frame_guard g(mb, caller);
+			t();
+		} catch(...) {
+			err = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		done = true;
+		cv.notify_all();
+	});
+
+	// a blocked thread of the executor is replaced by a helper
+	const bool blocking = (__current_exec == this);
+	if(blocking) {
+		size_t b = ++nblocked;
+		std::lock_guard<std::mutex> lock(helper_mtx);
+		if(b > helpers.size())
+			helpers.emplace_back([this]() { run(no_worker); });
+	}
+
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&]() { return done; });
+	lock.unlock();
+	if(blocking) nblocked--;
+	if(err) std::rethrow_exception(err);
+}
+
+
+void executor::schedule(host_mailbox* mb)
+{
+	if(__current_exec == this && __current_worker != no_worker) {
+		// push on the worker's own deque
+		worker& w = *workers[__current_worker];
+		std::lock_guard<std::mutex> lock(w.mtx);
+		w.ready.push_back(mb);
+		nready++;
+	} else {
+		std::lock_guard<std::mutex> lock(idle_mtx);
+		injected.push_back(mb);
+		nready++;
+	}
+
+	// wake up a sleeping worker, if any
+	if(nsleeping > 0) {
+		std::lock_guard<std::mutex> lock(idle_mtx);
+		idle_cv.notify_one();
+	}
+}
+
+
+host_mailbox* executor::next_ready(size_t self)
+{
+	const size_t n = workers.size();
+
+	// own deque, LIFO for locality
+	if(self != no_worker) {
+		worker& w = *workers[self];
+		std::lock_guard<std::mutex> lock(w.mtx);
+		if(! w.ready.empty()) {
+			host_mailbox* mb = w.ready.back();
+			w.ready.pop_back();
+			nready--;
+			return mb;
+		}
+	}
+
+	// steal from the other workers, FIFO
+	const size_t first = (self != no_worker) ? self : 0;
+	for(size_t i = (self != no_worker); i<n; i++) {
+		worker& v = *workers[(first+i) % n];
+		std::lock_guard<std::mutex> lock(v.mtx);
+		if(! v.ready.empty()) {
+			host_mailbox* mb = v.ready.front();
+			v.ready.pop_front();
+			nready--;
+			return mb;
+		}
+	}
+
+	// external submissions
+	std::lock_guard<std::mutex> lock(idle_mtx);
+	if(! injected.empty()) {
+		host_mailbox* mb = injected.front();
+		injected.pop_front();
+		nready--;
+		return mb;
+	}
+	return nullptr;
+}
+
+
+void executor::drain(host_mailbox* mb)
+{
+	// bound the number of tasks run at a time, for fairness
+	const size_t batch = 64;
+	for(size_t i=0; i<batch; i++) {
+		task t;
+		{
+			std::lock_guard<std::mutex> lock(mb->mtx);
+			if(mb->tasks.empty()) {
+				mb->scheduled = false;
+				return;
+			}
+			t = std::move(mb->tasks.front());
+			mb->tasks.pop_front();
+		}
+
+		try {
+			frame_guard g(mb, nullptr);
+			t();
+		} catch(...) {
+			std::lock_guard<std::mutex> lock(done_mtx);
+			if(! error) error = std::current_exception();
+		}
+
+		if(--pending == 0) {
+			std::lock_guard<std::mutex> lock(done_mtx);
+			done_cv.notify_all();
+		}
+	}
+	release(mb);
+}
+
+
+void executor::release(host_mailbox* mb)
+{
+	{
+		std::lock_guard<std::mutex> lock(mb->mtx);
+		if(mb->tasks.empty()) {
+			mb->scheduled = false;
+			return;
+		}
+	}
+	schedule(mb);
+}
+
+
+void executor::run(size_t self)
+{
+	__current_exec = this;
+	__current_worker = self;
+
+	while(true) {
+		host_mailbox* mb = next_ready(self);
+		if(mb) {
+			drain(mb);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(idle_mtx);
+		nsleeping++;
+		idle_cv.wait(lock, [this]() { return stopping || nready > 0; });
+		nsleeping--;
+		if(stopping && nready == 0) 
+			return;
+	}
+}
+
+
+void executor::wait()
+{
+	{
+		std::unique_lock<std::mutex> lock(done_mtx);
+		done_cv.wait(lock, [this]() { return pending == 0; });
+	}
+
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(done_mtx);
+		std::swap(e, error);
+	}
+	if(e) std::rethrow_exception(e);
+}
+
+
+
+//-------------------
+//
+//  fan-out pool
+//
+//-------------------
+
+// true on the threads of a fan-out pool
+static thread_local bool __in_fanout = false;
+
+struct fanout_pool::job
+{
+	const std::function<void(size_t, size_t)>* body;
+	size_t n;
+	size_t nblocks;
+	std::atomic<size_t> next { 0 };
+	std::atomic<size_t> done { 0 };
+	vector<std::exception_ptr> errors;
+	std::mutex mtx;
+	std::condition_variable cv;
+};
+
+
+fanout_pool::fanout_pool(network* _nw, size_t nthreads, size_t min_group)
+: nw(_nw), mingrp(std::max<size_t>(min_group, 1))
+{
+	if(nw->_fanout != nullptr)
+		throw std::logic_error("The network already has a fan-out pool");
+	if(nw->_lazy)
+		throw std::logic_error("The network has lazy channels");
+	if(nthreads==0)
+		nthreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	nw->set_sharded_counters(true);
+	nw->_fanout = this;
+
+	for(size_t i=0; i<nthreads; i++)
+		threads.emplace_back([this]() { loop(); });
+}
+
+
+fanout_pool::~fanout_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	for(auto& t : threads)
+		t.join();
+	nw->_fanout = nullptr;
+}
+
+
+void fanout_pool::work(job& j)
+{
+	size_t b;
+	while((b = j.next.fetch_add(1)) < j.nblocks) {
+		try {
+			(*j.body)(b*j.n/j.nblocks, (b+1)*j.n/j.nblocks);
+		} catch(...) {
+			j.errors[b] = std::current_exception();
+		}
+		if(j.done.fetch_add(1) + 1 == j.nblocks) {
+			std::lock_guard<std::mutex> lock(j.mtx);
+			j.cv.notify_all();
+		}
+	}
+}
+
+
+void fanout_pool::loop()
+{
+	__in_fanout = true;
+	uint64_t seen = 0;
+	while(true) {
+		std::shared_ptr<job> j;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]() { return stopping || generation != seen; });
+			if(stopping) return;
+			seen = generation;
+			j = current;
+		}
+		if(j) work(*j);
+	}
+}
+
+
+void fanout_pool::run(size_t n, const std::function<void(size_t, size_t)>& body)
+{
+	std::unique_lock<std::mutex> busy(run_mtx, std::defer_lock);
+	if(n == 0) return;
+	if(__in_fanout || threads.empty() || ! busy.try_lock()) {
+		body(0, n);
+		return;
+	}
+
+	// a few blocks per thread, to balance uneven handlers
+	auto j = std::make_shared<job>();
+	j->body = &body;
+	j->n = n;
+	j->nblocks = std::min(n, 4*(threads.size()+1));
+	j->errors.resize(j->nblocks);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		current = j;
+		generation++;
+	}
+	cv.notify_all();
+
+	__in_fanout = true;
+	work(*j);
+	__in_fanout = false;
+	{
+		std::unique_lock<std::mutex> lock(j->mtx);
+		j->cv.wait(lock, [&]() { return j->done == j->nblocks; });
+	}
+	// The finished job stays current until the next run, so that pool
+	// threads waking late find all its blocks taken and do nothing.
+
+	for(auto& e : j->errors)
+		if(e) std::rethrow_exception(e);
+}
+
+
+
+//-------------------
+//
+//  simulator
+//
+//-------------------
+
+
+latency_model::~latency_model() { }
+
+
+void linear_latency::set_latency(const channel* c, sim_time lat)
+{
+	if(lat == 0)
+		throw std::invalid_argument("channel latency must be positive");
+	if(c->id() >= chan_base.size())
+		chan_base.resize(c->id()+1, 0);
+	chan_base[c->id()] = lat;
+}
+
+
+simulator::simulator(network* _nw)
+: nw(_nw), _latency(new linear_latency())
+{
+	if(nw->_sim != nullptr)
+		throw std::logic_error("The network already has a simulator");
+	if(nw->_exec != nullptr)
+		throw std::logic_error("The network is run by an executor");
+	nw->_sim = this;
+}
+
+
+simulator::~simulator()
+{
+	nw->_sim = nullptr;
+	while(! queue.empty()) {
+		auto ev = queue.pop();
+		action(ev.second).clear();
+	}
+}
+
+
+void simulator::set_latency(latency_model* lm)
+{
+	if(lm == nullptr)
+		throw std::invalid_argument("null latency model");
+	_latency.reset(lm);
+}
+
+
+bool simulator::step()
+{
+	if(queue.empty()) return false;
+
+	auto ev = queue.pop();
+	_now = ev.first;
+	_processed++;
+
+	// the slot is released even if the action throws
+	struct release {
+		simulator* sim; uint32_t slot;
+		~release() { sim->free_slots.push_back(slot); }
+	} rel { this, ev.second };
+
+	action(ev.second)();
+	return true;
+}
+
+
+size_t simulator::run()
+{
+	size_t n = 0;
+	while(step()) n++;
+	return n;
+}
+
+
+size_t simulator::run_until(sim_time t)
+{
+	size_t n = 0;
+	while(! queue.empty() && queue.top_key() <= t) {
+		step();
+		n++;
+	}
+	if(t > _now) _now = t;
+	return n;
 }
 
 
@@ -450,7 +1875,7 @@ const rpc_protocol rpc_protocol::empty;
 
 
 rpc_proxy::rpc_proxy(size_t ifc, host* _own)
-: _r_ifc(ifc), _r_owner(_own)
+: _r_owner(_own), _r_bind(_own->net()->bind_interface(ifc)), _r_ifc(ifc)
 { 
 	assert(! _own->is_mcast()); 
 }
@@ -460,23 +1885,58 @@ rpc_proxy::rpc_proxy(const string& name, host* _own)
 : rpc_proxy(_own->net()->decl_interface(name), _own) 
 { }
 
-size_t rpc_proxy::_r_register(rpc_call* call) {
-	_r_calls.push_back(call);
-	if(_r_calls.size()>=1000)
-		throw std::runtime_error("proxy size too large (exceeds 1000 calls)");
-	return _r_calls.size();
+
+rpc_proxy::~rpc_proxy()
+{
+	if(_r_chans == nullptr) return;
+	network* nw = _r_owner->net();
+	const size_t n = 2*_r_size();
+	for(size_t i=0; i<n; i++)
+		if(_r_chans[i]) nw->disconnect(_r_chans[i]);
+	nw->arena().deallocate(_r_chans, n*sizeof(channel*));
 }
 
+
 void rpc_proxy::_r_connect(host* dst)
 {
 	assert(dst != _r_owner);
 	_r_proc = dst;
-	for(auto call : _r_calls) {
-		call->connect(dst);
+	if(_r_chans)
+		std::fill(_r_chans, _r_chans + 2*_r_size(), nullptr);
+
+	// with lazy channels, channels are opened by the calls
+	if(_r_owner->net()->lazy_channels())
+		return;
+	for(size_t i=0; i<_r_size(); i++) {
+		_r_open(i, false);
+		if(! _r_bind->calls[i].one_way)
+			_r_open(i, true);
 	}
 }
 
 
+channel* rpc_proxy::_r_open(size_t i, bool resp)
+{
+	if(_r_proc == nullptr)
+		throw std::logic_error("call on an unconnected proxy");
+	network* nw = _r_owner->net();
+	if(_r_chans == nullptr) {
+		const size_t n = 2*_r_size();
+		_r_chans = static_cast<channel**>(nw->arena().allocate(n*sizeof(channel*)));
+		std::fill(_r_chans, _r_chans + n, nullptr);
+	}
+
+	rpcc_t endp = _r_bind->calls[i].endpoint;
+	assert(_r_proc->is_mcast() <= _r_bind->calls[i].one_way); 
+	channel*& c = _r_chans[2*i + resp];
+	if(resp)
+		c = nw->connect(_r_proc, _r_owner, endp | RPCC_RESP_MASK);
+	else
+		c = nw->connect(_r_owner, _r_proc, endp);
+	return c;
+}
+
+
 //-------------------
 //
 //  RPC call
@@ -485,32 +1945,18 @@ void rpc_proxy::_r_connect(host* dst)
 
 
 
-rpc_call::rpc_call(rpc_proxy* _prx, bool _oneway, const string& _name)
-: _proxy(_prx), 
-	_endpoint(_prx->_r_owner->net()->decl_method(_prx->_r_ifc,_name, _oneway)), 
-	one_way(_oneway)
+rpc_call::rpc_call(rpc_proxy* _prx, bool _oneway, const string& _name,
+	rpc_binding::erased_method _meth)
 {
-	_prx->_r_register(this);
-}
-
-rpc_call::~rpc_call()
-{
-	network* nw = _proxy->_r_owner->net();
-	nw->disconnect(_req_chan);
-	if(! one_way)
-		nw->disconnect(_resp_chan);
-
-}
-
-void rpc_call::connect(host* dst)
-{
-	network* nw = _proxy->_r_owner->net();
-	host* owner = _proxy->_r_owner;
-
-	assert(dst->is_mcast() <= one_way); 
-	_req_chan = nw->connect(owner, dst, _endpoint);
-	if(! one_way)
-		_resp_chan = nw->connect(dst, owner, _endpoint | RPCC_RESP_MASK);
+	ptrdiff_t off = reinterpret_cast<char*>(this) - reinterpret_cast<char*>(_prx);
+	if(off <= 0 || off > UINT16_MAX)
+		throw std::length_error("remote method is not a member of its proxy");
+	if(_prx->_r_chans != nullptr)
+		throw std::logic_error("remote method added to a connected proxy");
+	_r_off = off;
+	_r_idx = _prx->_r_size();
+	_prx->_r_bind = _prx->_r_owner->net()->bind_method(_prx->_r_bind, 
+		_name, _oneway, _meth);
 }
 
 
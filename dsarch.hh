@@ -18,8 +18,27 @@
 #include <algorithm>
 #include <set>
 #include <map>
-
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <cassert>
+#include <cstddef>
+#include <ctime>
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "dsarch_config.hh"
 #include "dsarch_types.hh"
+#include "dsarch_codec.hh"
 
 namespace dsarch {
 
@@ -29,6 +48,11 @@ class network;
 class host;
 class host_group;
 class channel;
+class executor;
+class fanout_pool;
+struct host_mailbox;
+class simulator;
+struct hotspot_report;
 
 
 
@@ -156,6 +180,630 @@ typedef int32_t host_addr;
   */
 constexpr host_addr unknown_addr = std::numeric_limits<host_addr>::max();
 
+
+/**
+	A slab allocator for network objects.
+
+	Objects are carved out of large blocks, in size classes of 16 bytes,
+	and recycled through per-class free lists. Each network owns an
+	arena, which allocates its channels and the channel slots of its
+	proxies. All blocks are released at once when the arena is 
+	destroyed. Requests larger than \c max_size go to the global 
+	allocator.
+
+	Blocks can optionally be backed by huge pages, which reduces TLB
+	misses for very large networks. If explicit huge pages are not 
+	available, transparent huge pages are requested instead.
+
+	The arena is not thread-safe.
+  */
+class slab_arena
+{
+public:
+	static constexpr size_t granule = 16;
+	static constexpr size_t max_size = 1024;
+	static constexpr size_t block_size = 1<<21;
+
+	slab_arena() {}
+	~slab_arena();
+
+	slab_arena(const slab_arena&) = delete;
+	slab_arena& operator=(const slab_arena&) = delete;
+
+	/// Back new blocks by huge pages
+	inline void set_huge_pages(bool enable) { huge = enable; }
+
+	/// True if new blocks are backed by huge pages
+	inline bool huge_pages() const { return huge; }
+
+	/// The memory reserved in blocks
+	inline size_t reserved() const { return blocks.size()*block_size; }
+
+	inline void* allocate(size_t n) {
+		if(n > max_size) return ::operator new(n);
+		size_t c = class_of(n);
+		if(heads[c] == nullptr) refill(c);
+		node* ret = heads[c];
+		heads[c] = ret->next;
+		return ret;
+	}
+
+	inline void deallocate(void* p, size_t n) {
+		if(n > max_size) { ::operator delete(p); return; }
+		size_t c = class_of(n);
+		node* nd = static_cast<node*>(p);
+		nd->next = heads[c];
+		heads[c] = nd;
+	}
+
+	/**
+		Construct an object in the arena. Over-aligned types are
+		allocated by \c new.
+	  */
+	template <typename T, typename...Args>
+	inline T* make(Args&&...args) {
+		if constexpr (alignof(T) > granule)
+			return new T(std::forward<Args>(args)...);
+		void* p = allocate(sizeof(T));
+		try {
+			return new (p) T(std::forward<Args>(args)...);
+		} catch(...) {
+			deallocate(p, sizeof(T));
+			throw;
+		}
+	}
+
+	/// Destroy an object constructed by \c make()
+	template <typename T>
+	inline void destroy(T* obj) {
+		if constexpr (alignof(T) > granule) {
+			delete obj;
+		} else {
+			obj->~T();
+			deallocate(obj, sizeof(T));
+		}
+	}
+
+private:
+	struct node { node* next; };
+	static constexpr size_t nclasses = max_size/granule;
+
+	node* heads[nclasses] = {};
+	vector<void*> blocks;
+	char* cur = nullptr;		// the unused part of the last block
+	size_t left = 0;
+	bool huge = false;
+
+	static inline size_t class_of(size_t n) { 
+		return n==0 ? 0 : (n + granule - 1)/granule - 1; 
+	}
+	void refill(size_t c);
+};
+
+
+/**
+	A standard allocator over a \c slab_arena.
+  */
+template <typename T>
+struct arena_allocator
+{
+	typedef T value_type;
+	slab_arena* arena;
+
+	arena_allocator(slab_arena* a) : arena(a) {}
+	template <typename U>
+	arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+
+	inline T* allocate(size_t n) { 
+		return static_cast<T*>(arena->allocate(n*sizeof(T))); 
+	}
+	inline void deallocate(T* p, size_t n) { arena->deallocate(p, n*sizeof(T)); }
+
+	template <typename U>
+	inline bool operator==(const arena_allocator<U>& other) const { 
+		return arena == other.arena; 
+	}
+};
+
+
+/**
+	Running traffic totals of an rpc endpoint or interface.
+  */
+struct traffic_totals
+{
+	size_t msgs = 0, byts = 0;
+	size_t rxmsgs = 0, rxbyts = 0;
+
+	inline traffic_totals& operator+=(const traffic_totals& t) {
+		msgs += t.msgs; byts += t.byts;
+		rxmsgs += t.rxmsgs; rxbyts += t.rxbyts;
+		return *this;
+	}
+
+	inline traffic_totals& operator-=(const traffic_totals& t) {
+		msgs -= t.msgs; byts -= t.byts;
+		rxmsgs -= t.rxmsgs; rxbyts -= t.rxbyts;
+		return *this;
+	}
+};
+
+
+/**
+	Traffic counters for all the channels of a network.
+
+	The counters are stored by column, each column indexed by
+	the dense channel id (see \c channel::id()). Slots of channels that
+	have been disconnected are zeroed, so that summing a whole column
+	yields the network total.
+
+	The \c rxmsgs and \c rxbyts columns are only updated by multicast
+	channels; they are zero for unicast channels.
+
+	In addition, running totals are kept per rpc endpoint and per
+	interface, so that the traffic of a method or an interface can be
+	read without scanning the channels. Like the columns, they only
+	cover channels that have not been disconnected.
+
+	Totals are also kept per host address. These are cumulative: they
+	are not reduced when channels are disconnected, since the deliveries
+	of a multicast cannot be attributed back to receivers once group
+	membership has changed.
+
+	When sharding is enabled (see \c network::set_sharded_counters()),
+	transmissions are accumulated into per-thread shards, which are 
+	merged into these columns lazily, by \c sync().
+  */
+struct channel_counters
+{
+	vector<size_t> msgs, byts;
+	vector<size_t> rxmsgs, rxbyts;
+
+	/**
+		Totals by endpoint, indexed by rpc code, and by interface,
+		indexed by rpc code shifted by \c RPCC_BITS_PER_IFC. They
+		grow when an endpoint first transmits.
+	  */
+	vector<traffic_totals> by_endp, by_ifc;
+
+	/**
+		Totals by host index (see \c host::index()). For hosts, \c msgs 
+		and \c byts count the messages sent, and \c rxmsgs and \c rxbyts 
+		the messages received, including every delivery of a multicast.
+	  */
+	vector<traffic_totals> by_host;
+
+	/// Per-thread shards, or null if sharding is disabled
+	std::unique_ptr<class counter_shards> shards;
+
+	/// Windowed counters, or null if disabled
+	std::unique_ptr<class traffic_windows> windows;
+
+	/// Message trace writer, or null if not tracing
+	class trace_writer* trace = nullptr;
+
+	channel_counters();
+	~channel_counters();
+
+	/// The number of slots in the columns
+	inline size_t size() const { return msgs.size(); }
+
+	/// Append a zeroed slot, returning its index
+	size_t grow();
+
+	/// Make sure the columns have at least \c n slots
+	void reserve_slots(size_t n);
+
+	/**
+		The counters that the calling thread should update for
+		channel \c cid. 
+	  */
+	inline channel_counters& local(size_t cid);
+
+	/**
+		Merge the per-thread shards (if any) into the columns.
+
+		This must not be called concurrently with transmissions.
+	  */
+	inline void sync() { if(shards) merge_shards(); }
+
+	void merge_shards();
+
+	/// Zero the counters of a slot
+	void clear(size_t cid);
+
+	/**
+		Zero the counters of a slot, deducting them from the totals
+		of endpoint \c endp.
+	  */
+	void clear(size_t cid, rpcc_t endp);
+
+	/// Add traffic of endpoint \c endp to the totals
+	inline void count_endp(rpcc_t endp, size_t m, size_t b, 
+		size_t rxm = 0, size_t rxb = 0) 
+	{
+		if(endp >= by_endp.size()) grow_totals(endp);
+		traffic_totals& e = by_endp[endp];
+		traffic_totals& i = by_ifc[endp >> RPCC_BITS_PER_IFC];
+		e.msgs += m; e.byts += b; e.rxmsgs += rxm; e.rxbyts += rxb;
+		i.msgs += m; i.byts += b; i.rxmsgs += rxm; i.rxbyts += rxb;
+	}
+
+	/// Make sure there are totals for endpoint \c endp
+	void grow_totals(rpcc_t endp);
+
+	/// Make sure there are totals for host indices below \c n
+	inline void reserve_hosts(size_t n) {
+		if(n > by_host.size()) 
+			by_host.resize(std::max(n, 2*by_host.size()));
+	}
+
+	/// The totals of a host index, growing them if needed
+	inline traffic_totals& host_totals(size_t i) {
+		reserve_hosts(i+1);
+		return by_host[i];
+	}
+
+	/// The totals of an endpoint (zero if it never transmitted)
+	inline traffic_totals endp_totals(rpcc_t endp) const {
+		return endp < by_endp.size() ? by_endp[endp] : traffic_totals();
+	}
+
+	/// The totals of the interface of a code
+	inline traffic_totals ifc_totals(rpcc_t code) const {
+		size_t i = code >> RPCC_BITS_PER_IFC;
+		return i < by_ifc.size() ? by_ifc[i] : traffic_totals();
+	}
+
+	/// Sum of a column over all slots
+	static size_t sum(const vector<size_t>& col);
+};
+
+
+/**
+	Per-thread shards of channel counters.
+
+	Each thread that transmits on a sharded network gets its own
+	\c channel_counters, allocated on its own cache lines, so that
+	threads never contend on counter updates.
+  */
+class counter_shards
+{
+	struct alignas(64) shard {
+		channel_counters ctr;
+		bool dirty = false;
+	};
+
+	std::mutex mtx;
+	vector<std::unique_ptr<shard>> shards;
+	const size_t serial;
+
+	shard* register_thread();
+public:
+	counter_shards();
+
+	/// The shard of the calling thread, creating it if needed
+	inline shard* local() {
+		thread_local size_t last_serial = 0;
+		thread_local shard* last = nullptr;
+		if(last_serial != serial) {
+			last = register_thread();
+			last_serial = serial;
+		}
+		return last;
+	}
+
+	/// Add all shards into \c main and zero them
+	void merge_into(channel_counters& main);
+
+	friend struct channel_counters;
+};
+
+
+/**
+	Windowed (time-series) traffic counters.
+
+	Time is divided into epochs, advanced network-wide by 
+	\c network::tick(). For each channel, a ring buffer holds the 
+	number of messages and bytes sent in each of the last \c length() 
+	epochs. 
+
+	Rings are allocated when a channel first transmits, so idle 
+	channels cost nothing, and are rotated lazily, on the next transmit 
+	or never, so ticks are O(1).
+  */
+class traffic_windows
+{
+	size_t W;
+	size_t cur = 0;
+
+	// by channel id: [0] is the last epoch recorded, followed by
+	// W message counts and W byte counts
+	vector<std::unique_ptr<size_t[]>> rings;
+
+	size_t* ring(size_t cid);
+	inline const size_t* ring(size_t cid, size_t epoch) const {
+		if(cid >= rings.size() || !rings[cid]) return nullptr;
+		const size_t* r = rings[cid].get();
+		if(epoch > r[0] || epoch + W <= cur) return nullptr;
+		return r;
+	}
+public:
+	/// Keep windows for the last \c nwindows epochs
+	traffic_windows(size_t nwindows);
+
+	/// The number of epochs retained
+	inline size_t length() const { return W; }
+
+	/// The current epoch
+	inline size_t epoch() const { return cur; }
+
+	/// Advance to the next epoch
+	inline void tick() { cur++; }
+
+	/// Record a transmission on a channel, in the current epoch
+	inline void record(size_t cid, size_t msg_size) {
+		size_t* r = ring(cid);
+		size_t slot = cur % W;
+		r[1+slot]++;
+		r[1+W+slot] += msg_size;
+	}
+
+	/// Release the ring of a channel
+	void clear(size_t cid);
+
+	/// True if a channel has transmitted since windows were enabled
+	inline bool active(size_t cid) const { 
+		return cid < rings.size() && rings[cid]; 
+	}
+
+	/**
+		Messages sent on a channel in an epoch. This is 0 for epochs 
+		that are not retained.
+	  */
+	inline size_t msgs(size_t cid, size_t epoch) const {
+		const size_t* r = ring(cid, epoch);
+		return r ? r[1 + epoch % W] : 0;
+	}
+
+	/**
+		Bytes sent on a channel in an epoch. This is 0 for epochs
+		that are not retained.
+	  */
+	inline size_t bytes(size_t cid, size_t epoch) const {
+		const size_t* r = ring(cid, epoch);
+		return r ? r[1 + W + epoch % W] : 0;
+	}
+
+	/// Messages sent on a channel in epochs [from, to)
+	size_t msgs(size_t cid, size_t from, size_t to) const;
+
+	/// Bytes sent on a channel in epochs [from, to)
+	size_t bytes(size_t cid, size_t from, size_t to) const;
+};
+
+
+inline channel_counters& channel_counters::local(size_t cid)
+{
+	if(! shards) return *this;
+	auto sh = shards->local();
+	if(cid >= sh->ctr.size())
+		sh->ctr.reserve_slots(size());
+	sh->dirty = true;
+	return sh->ctr;
+}
+
+
+/**
+	A cheap clock for timing remote call handlers.
+
+	On x86 this is the time-stamp counter; elsewhere, it is 
+	\c CLOCK_MONOTONIC in nanoseconds. Ticks are converted to 
+	nanoseconds by \c ns_per_tick(), which is calibrated once 
+	against the steady clock.
+  */
+struct tick_clock
+{
+	/// The current tick
+	static inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec)*1000000000u + ts.tv_nsec;
+#endif
+	}
+
+	/// Nanoseconds per tick
+	static double ns_per_tick();
+};
+
+
+/**
+	A log-bucketed histogram of durations, in nanoseconds.
+
+	As in HDR histograms, values below \c sub_count get a bucket each, 
+	and each larger range [2^k, 2^(k+1)) is split into \c sub_count 
+	equal buckets, so that every value is within 1/sub_count of the low
+	end of its bucket. The buckets take a fixed 4KB.
+
+	Recording is thread-safe. Reading while other threads are recording
+	gives approximate results.
+  */
+class time_histogram
+{
+public:
+	static constexpr int sub_bits = 3;
+	static constexpr size_t sub_count = size_t(1) << sub_bits;
+	static constexpr size_t num_buckets = (64 - sub_bits + 1) * sub_count;
+
+	/// The bucket of a value
+	static constexpr size_t bucket(uint64_t v) {
+		if(v < sub_count) return v;
+		int k = 63 - __builtin_clzll(v);
+		return (k - sub_bits + 1) * sub_count 
+			+ ((v >> (k - sub_bits)) & (sub_count - 1));
+	}
+
+	/// The smallest value of a bucket
+	static constexpr uint64_t bucket_low(size_t b) {
+		if(b < sub_count) return b;
+		int k = b / sub_count + sub_bits - 1;
+		return uint64_t(sub_count + b % sub_count) << (k - sub_bits);
+	}
+
+	/// The largest value of a bucket
+	static constexpr uint64_t bucket_high(size_t b) {
+		return (b+1 < num_buckets) ? bucket_low(b+1) - 1 
+			: std::numeric_limits<uint64_t>::max();
+	}
+
+	/// Record a duration
+	inline void record(uint64_t ns) {
+		std::atomic_ref<uint64_t>(counts[bucket(ns)]).fetch_add(1, std::memory_order_relaxed);
+		std::atomic_ref<uint64_t>(n).fetch_add(1, std::memory_order_relaxed);
+		std::atomic_ref<uint64_t>(sum).fetch_add(ns, std::memory_order_relaxed);
+		std::atomic_ref<uint64_t> lo_ref(lo), hi_ref(hi);
+		uint64_t x = lo_ref.load(std::memory_order_relaxed);
+		while(ns < x && ! lo_ref.compare_exchange_weak(x, ns, std::memory_order_relaxed));
+		x = hi_ref.load(std::memory_order_relaxed);
+		while(ns > x && ! hi_ref.compare_exchange_weak(x, ns, std::memory_order_relaxed));
+	}
+
+	/// The number of recorded durations
+	inline size_t count() const { return n; }
+
+	/// The number of durations in a bucket
+	inline size_t count(size_t b) const { return counts[b]; }
+
+	/// The sum of the recorded durations
+	inline uint64_t total() const { return sum; }
+
+	/// The mean duration, or 0 if empty
+	inline double mean() const { return n ? double(sum)/n : 0.0; }
+
+	/// The smallest duration, or 0 if empty
+	inline uint64_t min() const { return n ? lo : 0; }
+
+	/// The largest duration
+	inline uint64_t max() const { return hi; }
+
+	/**
+		The q-quantile, for q in [0,1], to within the precision of
+		the buckets. This is 0 if the histogram is empty.
+	  */
+	uint64_t quantile(double q) const;
+
+	/// Add the counts of another histogram
+	void merge(const time_histogram& other);
+
+	/// Remove all durations
+	void clear();
+
+private:
+	uint64_t counts[num_buckets] = { 0 };
+	uint64_t n = 0;
+	uint64_t sum = 0;
+	uint64_t lo = std::numeric_limits<uint64_t>::max();
+	uint64_t hi = 0;
+};
+
+
+/**
+	Handler times of remote calls, by endpoint.
+
+	When the library is configured with \c --enable-profile, which 
+	defines \c DSARCH_PROFILE in the generated \c dsarch_config.hh,
+	and profiling is enabled by \c network::set_handler_profiling(),
+	every invocation of a remote method handler is timed by 
+	\c tick_clock and recorded in the histogram of the request endpoint
+	of the method. Times are inclusive: they include the handlers of 
+	the calls that a handler makes. Without \c DSARCH_PROFILE, remote 
+	calls contain no profiling code at all.
+
+	Histograms are allocated on the first call of each method, in a 
+	two-level table indexed by the interface and method bits of the 
+	endpoint. Recording is lock-free, so that handlers can be timed
+	under an executor or a fan-out pool.
+  */
+class handler_profile
+{
+public:
+	/// Interfaces beyond this many are not profiled
+	static constexpr size_t max_interfaces = 4096;
+
+	handler_profile();
+	~handler_profile();
+
+	handler_profile(const handler_profile&) = delete;
+	handler_profile& operator=(const handler_profile&) = delete;
+
+	/// Record a handler time, in ticks of \c tick_clock
+	inline void record(rpcc_t endp, uint64_t ticks) {
+		if(time_histogram* h = histogram(endp))
+			h->record(uint64_t(ticks * ns_per_tick));
+	}
+
+	/**
+		The histogram of a method endpoint, or null if no handler
+		of the method has been timed.
+	  */
+	const time_histogram* method(rpcc_t endp) const;
+
+	/// The merged histograms of all the methods of an interface
+	time_histogram interface(rpcc_t ifc) const;
+
+	/// Apply a function to the histograms of all endpoints, in rpcc order
+	void for_each(
+		const std::function<void(rpcc_t, const time_histogram&)>& func) const;
+
+private:
+	static constexpr size_t methods = (RPCC_METH_MASK >> 1) + 1;
+
+	struct segment {
+		std::atomic<time_histogram*> meth[methods] = {};
+	};
+
+	std::atomic<segment*> dir[max_interfaces] = {};
+	double ns_per_tick;
+
+	time_histogram* create(rpcc_t endp);
+
+	inline time_histogram* histogram(rpcc_t endp) {
+		size_t i = endp >> RPCC_BITS_PER_IFC;
+		if(i < max_interfaces)
+			if(segment* seg = dir[i].load(std::memory_order_acquire))
+				if(time_histogram* h = seg->meth[(endp & RPCC_METH_MASK) >> 1]
+						.load(std::memory_order_acquire))
+					return h;
+		return create(endp);
+	}
+};
+
+
+/**
+	Static attributes for all the channels of a network.
+
+	Like \c channel_counters, these are columns indexed by the dense
+	channel id. They are used by \c chan_query to evaluate predicates
+	without touching the channel objects. The \c live bitmap marks the
+	ids of channels that currently exist.
+  */
+struct channel_attrs
+{
+	vector<host_addr> src, dst;
+	vector<rpcc_t> rpcc;
+	vector<uint8_t> mcast;
+	vector<uint64_t> live;
+
+	/// Set the attributes of a slot, growing the columns if needed
+	void set(size_t cid, host_addr s, host_addr d, rpcc_t r, bool m);
+
+	/// Mark a slot as not live
+	void clear(size_t cid);
+};
+
+
 /**
 	Point-to-point or broadcast unidirectional channel.
 
@@ -178,6 +826,10 @@ constexpr host_addr unknown_addr = std::numeric_limits<host_addr>::max();
 	\f[  \prod_{i=1}^m n_i d_i q_i  \f] 
 	request channels in the network, and up to that many response channels.
 
+	Each channel is given a dense id by the network upon creation. The 
+	counters of the channel are not stored in the channel object itself,
+	but in the \c channel_counters columns of the network, at this id.
+
 	Finally, a channel can be a multicast channel. This is always associated
 	with some one-way rpc method, sendind data from a single source host A
 	to a destination host group B. Again, there are two channels associated with
@@ -194,8 +846,10 @@ class channel
 protected:
 	host *src, *dst;
 	rpcc_t rpcc;
+	bool pooled = false;		// allocated in the network's arena
 
-	size_t msgs, byts;
+	size_t cid;					// dense id, assigned by the network
+	channel_counters* ctr;		// the counter columns of the network
 
 	channel(host *s, host* d, rpcc_t rpcc);
 public:
@@ -211,25 +865,28 @@ public:
 	/** The rpcc code */
 	inline rpcc_t rpc_code() const { return rpcc; }
 
+	/** The dense id of this channel in its network */
+	inline size_t id() const { return cid; }
+
 	/** Number of messages sent */
-	inline auto messages() const { return msgs; }
+	inline size_t messages() const { ctr->sync(); return ctr->msgs[cid]; }
 
 	/** Number of bytes sent */
-	inline auto bytes() const { return byts; }
+	inline size_t bytes() const { ctr->sync(); return ctr->byts[cid]; }
 
 	/** 
 		Number of messages received. 
 		For broadcast channels this is not the same as
 		the number of messages sent.
 	  */
-	virtual size_t messages_received() const { return msgs; }
+	virtual size_t messages_received() const { return messages(); }
 
 	/** 
 		Number of bytes received. 
 		For broadcast channels, this is not the same as the
 		bytes sent.
 	  */
-	virtual size_t bytes_received() const { return byts; }
+	virtual size_t bytes_received() const { return bytes(); }
 
 	/**
 		Register the transmission of a message on this channel
@@ -260,8 +917,6 @@ public:
 class multicast_channel : public channel
 {
 protected:
-	size_t rxmsgs, rxbyts;
-
 	multicast_channel(host *s, host_group* d, rpcc_t rpcc);	
 public:
 
@@ -282,6 +937,36 @@ typedef std::unordered_set<channel*> channel_set;
 /// A set of hosts
 typedef std::unordered_set<host*> host_set;
 
+/**
+	The key of a channel in the network-wide channel index.
+
+	A channel is uniquely identified by the triple (src, dst, rpcc).
+  */
+struct channel_key
+{
+	host* src;
+	host* dst;
+	rpcc_t rpcc;
+
+	inline bool operator==(const channel_key& other) const {
+		return src==other.src && dst==other.dst && rpcc==other.rpcc;
+	}
+};
+
+/// Hash function for \c channel_key
+struct channel_key_hash
+{
+	inline size_t operator()(const channel_key& k) const {
+		size_t h = std::hash<host*>()(k.src);
+		h ^= std::hash<host*>()(k.dst) + 0x9e3779b97f4a7c15ULL + (h<<6) + (h>>2);
+		h ^= std::hash<rpcc_t>()(k.rpcc) + 0x9e3779b97f4a7c15ULL + (h<<6) + (h>>2);
+		return h;
+	}
+};
+
+/// An index of channels by their key
+typedef std::unordered_map<channel_key, channel*, channel_key_hash> channel_index;
+
 /**
 	Hosts are used as nodes in the network.
 
@@ -300,11 +985,16 @@ class host : public named
 
 	network* _net;
 	host_addr _addr;
+	uint32_t _index;
 	bool _mcast;
 
 	friend class host_group;
 	friend class network;
+	friend class executor;
 	channel_set _incoming;
+
+	// the work queue of this host, when run by an executor
+	std::atomic<host_mailbox*> _mbox { nullptr };
 public:
 
 	host(network* n);
@@ -332,6 +1022,19 @@ public:
 	  */
 	host_addr addr();
 
+	/**
+		The index of a simple host, assigned together with its address.
+
+		Indices are dense: the n-th simple host of a network to get an
+		address has index n-1, whatever its address. They are not reused
+		when hosts are destroyed. Host groups have no index, and return
+		\c no_index.
+	  */
+	inline size_t index() { addr(); return _index; }
+
+	/// The index of host groups
+	static constexpr size_t no_index = UINT32_MAX;
+
 	/**
 		Ask for an address explicitly.
 		If the address is successfully obtained, returns true,
@@ -371,35 +1074,124 @@ public:
 		The members of the group
 	  */
 	virtual size_t receivers(host* sender)=0;
+
+	/**
+		Count the delivery of a message of \c msg_size bytes from 
+		\c sender to each receiver, into \c c.by_host. The default 
+		does nothing, for groups that cannot enumerate their members.
+	  */
+	virtual void count_deliveries(host* sender, channel_counters& c, 
+		size_t msg_size) { }
 };
 
 
 /**
 	A typed implementation of \c host_group
 
-	This implementation stores the group hosts in an \c std::set.
+	Members are stored in a dense array, so that iteration over large
+	groups is cache-friendly, together with a table of member positions
+	indexed by host index (see \c host::index()). Thus, \c join(), 
+	\c leave(), \c contains() and \c receivers() take constant time. 
+	The order of iteration is the order of joining, except that a 
+	leaving member is replaced by the last member.
+
+	During a sequential multicast call, handlers may join or leave the 
+	group: the call goes to the members at its start that are still
+	members when their turn comes. Members that join during the call
+	do not receive it. When the call is fanned out over a 
+	\c fanout_pool, handlers run in parallel and must not change the 
+	membership.
+
+	Members must be simple hosts. The position table grows up to the 
+	largest member index, which is bounded by the number of hosts, 
+	however sparse their addresses.
   */
 template <typename Process>
 struct mcast_group : host_group
 { 
-	typedef set<Process*> Container;
+	typedef vector<Process*> Container;
 private:
 	Container memb;
+	vector<uint32_t> midx;	// the host indices of memb
+	vector<uint32_t> slot;	// position+1 in memb, by host index (0 if absent)
+
+	// the position of a host in memb, or memb.size()
+	inline size_t position(host* h) const {
+		size_t i = h->index();
+		if(i >= slot.size() || slot[i] == 0) 
+			return memb.size();
+		size_t p = slot[i]-1;
+		return (static_cast<host*>(memb[p]) == h) ? p : memb.size();
+	}
 public:
-	typedef typename Container::iterator iterator;
+	typedef typename Container::const_iterator iterator;
 
 	inline mcast_group(network* _nw) : host_group(_nw) { }
 
-	inline void join(Process* host) {  memb.insert(host); }
-	inline void leave(Process* host) { memb.erase(host); }
+	inline void join(Process* host) {
+		if(position(host) != memb.size()) return;
+		size_t i = host->index();
+		if(i == host::no_index)
+			throw std::invalid_argument("group members must be simple hosts");
+		if(i >= slot.size())
+			slot.resize(std::max<size_t>(i+1, 2*slot.size()), 0);
+		memb.push_back(host);
+		midx.push_back(i);
+		slot[i] = memb.size();
+	}
 
-	inline bool contains(Process* host) const { return memb.count(host)>0; }
-	inline iterator begin() { return memb.begin(); }
-	inline iterator end() { return memb.end(); }
+	inline void leave(Process* host) {
+		size_t p = position(host);
+		if(p == memb.size()) return;
+		memb[p] = memb.back();
+		midx[p] = midx.back();
+		slot[midx[p]] = p+1;
+		slot[host->index()] = 0;
+		memb.pop_back();
+		midx.pop_back();
+	}
 
-	virtual size_t receivers(host* sender) override {
-		auto snd = dynamic_cast<Process*>(sender);
-		return memb.size() - memb.count(snd);
+	inline bool contains(Process* host) const { 
+		return position(host) != memb.size(); 
+	}
+
+	/// The number of members
+	inline size_t size() const { return memb.size(); }
+
+	/// The members, in iteration order
+	inline const Container& members() const { return memb; }
+
+	/// The host indices of the members, in iteration order
+	inline const vector<uint32_t>& member_indices() const { return midx; }
+
+	/// The member with host index \c i, or null if there is none
+	inline Process* member(size_t i) const {
+		return (i < slot.size() && slot[i] != 0) ? memb[slot[i]-1] : nullptr;
+	}
+
+	inline iterator begin() const { return memb.begin(); }
+	inline iterator end() const { return memb.end(); }
+
+	virtual size_t receivers(host* sender) override {
+		return memb.size() - (sender && position(sender) != memb.size());
+	}
+
+	virtual void count_deliveries(host* sender, channel_counters& c, 
+		size_t msg_size) override 
+	{
+		if(memb.empty()) return;
+		c.reserve_hosts(slot.size());
+		traffic_totals* t = c.by_host.data();
+		for(uint32_t i : midx) {
+			t[i].rxmsgs++;
+			t[i].rxbyts += msg_size;
+		}
+		// the sender does not receive its own message
+		size_t p = sender ? position(sender) : memb.size();
+		if(p != memb.size()) {
+			t[midx[p]].rxmsgs--;
+			t[midx[p]].rxbyts -= msg_size;
+		}
 	}
 
 };
@@ -532,6 +1324,41 @@ struct rpc_protocol : public named
 struct rpc_call;
 
 
+/**
+	The method table of a proxy type, in a network.
+
+	Proxies do not store per-method data. Instead, all proxies of the
+	same type share a table describing their methods, in the order of
+	declaration. Tables are built as proxies are constructed: each
+	remote method member advances its proxy from a table to a table
+	with one more method. Thus, tables form a tree rooted at the empty
+	table of each interface, and proxies with the same sequence of
+	methods end up on the same node.
+
+	The tables are owned by the network.
+  */
+struct rpc_binding
+{
+	/// A type-erased member function pointer
+	typedef void (host::* erased_method)();
+
+	/// An entry of the table
+	struct call {
+		rpcc_t endpoint;
+		bool one_way;
+		erased_method method;
+		string name;
+	};
+
+	rpcc_t ifc;
+	vector<call> calls;
+
+	// tables are only extended, never modified
+	mutable vector<std::unique_ptr<rpc_binding>> children;
+
+	rpc_binding(rpcc_t _ifc) : ifc(_ifc) {}
+};
+
 
 /**
 	An rpc proxy represents a proxy object for some host.
@@ -546,6 +1373,11 @@ struct rpc_call;
 	being proxied. In middleware terms, the proxy instantiates
 	the interface.
 
+	A proxy stores its owner and destination, a pointer to the 
+	method table shared by all proxies of its type (see 
+	\c rpc_binding), and a pointer to its channels, two per method,
+	which is allocated when the channels are first opened.
+
 	This class serves as the base class for the
 	\c remote_proxy<T> template class.
 
@@ -556,26 +1388,44 @@ struct rpc_call;
 class rpc_proxy
 {
 public:
-	/** Interface code for the proxy. */
-	rpcc_t _r_ifc;
-
-	/** The collection of calls */
-	vector<rpc_call*> _r_calls;
-
 	/** The owner of the proxy is the process that holds the proxy */
 	host* _r_owner;
 
 	/** This is the node being proxied. */
 	host* _r_proc = nullptr;
+
+	/** The method table */
+	const rpc_binding* _r_bind;
+
+	/** The request and response channels of each method, or null */
+	channel** _r_chans = nullptr;
+
+	/** Interface code for the proxy. */
+	rpcc_t _r_ifc;
+
+	/** True if connected to a group */
+	bool _r_mcast = false;
+
+	/** The number of remote methods */
+	inline size_t _r_size() const { return _r_bind->calls.size(); }
+
+	/** The endpoint of the i-th remote method */
+	inline rpcc_t _r_endpoint(size_t i) const { return _r_bind->calls[i].endpoint; }
+
+	/** Disconnect the channels of the proxy */
+	~rpc_proxy();
+
+	rpc_proxy(const rpc_proxy&) = delete;
+	rpc_proxy& operator=(const rpc_proxy&) = delete;
 private:
 	template <typename Dest>
 	friend class remote_proxy;
 	template <typename Dest>
 	friend class multicast_proxy;
-	friend class rpc_call;
+	friend struct rpc_call;
 	rpc_proxy(size_t ifc, host* _own);
-	size_t _r_register(rpc_call* call);
 	void _r_connect(host* dst);
+	channel* _r_open(size_t i, bool resp);
 public:
 	rpc_proxy(const string& name, host* _own);
 };
@@ -583,24 +1433,66 @@ public:
 
 /**
 	An rcp call  belongs to some specific rpc proxy.
+
+	Calls are members of their proxy. They only store their offset in
+	the proxy object and their index in the proxy's method table.
+	Therefore, calls cannot be copied.
   */
 struct rpc_call
 {
 protected:
-	rpc_proxy* _proxy;
-	rpcc_t _endpoint;
-	channel* _req_chan = nullptr;
-	channel* _resp_chan = nullptr;
-	bool one_way;
+	uint16_t _r_off;
+	uint16_t _r_idx;
+
+	rpc_call(rpc_proxy* _prx, bool _oneway, const string& _name, 
+		rpc_binding::erased_method _meth);
+
+	inline const rpc_binding::call& info() const { 
+		return _proxy()->_r_bind->calls[_r_idx]; 
+	}
 public:
-	rpc_call(rpc_proxy* _prx, bool _oneway, const string& _name);
-	virtual ~rpc_call();
+	rpc_call(const rpc_call&) = delete;
+	rpc_call& operator=(const rpc_call&) = delete;
 
-	void connect(host* dst);
+	/// The proxy of this call
+	inline rpc_proxy* _proxy() const { 
+		return reinterpret_cast<rpc_proxy*>(
+			const_cast<char*>(reinterpret_cast<const char*>(this)) - _r_off);
+	}
+
+	inline rpcc_t endpoint() const { return info().endpoint; }
+
+	inline bool one_way() const { return info().one_way; }
+
+	/**
+		The request channel. On networks with lazy channels, this
+		is null until the call first transmits a request.
+	  */
+	inline channel* request_channel() const { 
+		channel** c = _proxy()->_r_chans;
+		return c ? c[2*_r_idx] : nullptr;
+	}
+
+	/**
+		The response channel. On networks with lazy channels, this
+		is null until the call first transmits a response.
+	  */
+	inline channel* response_channel() const { 
+		channel** c = _proxy()->_r_chans;
+		return c ? c[2*_r_idx+1] : nullptr;
+	}
 
-	inline rpcc_t endpoint() const { return _endpoint; }
-	inline channel* request_channel() const { return _req_chan; }
-	inline channel* response_channel() const { return _resp_chan; }
+	/// The request channel, created if needed
+	inline channel* open_request() const {
+		channel* c = request_channel();
+		return c ? c : _proxy()->_r_open(_r_idx, false);
+	}
+
+	/// The response channel, created if needed
+	inline channel* open_response() const {
+		channel* c = response_channel();
+		return c ? c : _proxy()->_r_open(_r_idx, true);
+	}
 };
 
 
@@ -636,16 +1528,51 @@ protected:
 	host_set _hosts;		// all the simple hosts
 	host_set _groups;		// all the host groups
 	channel_set _channels;	// all the channels
+	channel_index _chan_index;	// channels by (src, dst, rpcc)
+
+	// channel counters and attributes, by dense channel id
+	mutable channel_counters _counters;
+	channel_attrs _attrs;
+	vector<channel*> _chan_by_id;
+	vector<size_t> _free_cids;
 
 	// address maps
 	std::unordered_map<host_addr, host*> addr_map;
 	host_addr new_host_addr;
 	host_addr new_group_addr;
+	uint32_t new_host_index = 0;
 
 	// rpc protocol
 	rpc_protocol rpctab;
 
+	// the executor running this network, if any
+	executor* _exec = nullptr;
+
+	// the pool for parallel multicast fan-out, if any
+	fanout_pool* _fanout = nullptr;
+
+	// the codec for sizing remote call messages
+	wire_codec _codec = wire_codec::estimate;
+
+	// the arena for channels and channel slots
+	mutable slab_arena _arena;
+
+	// create channels on first transmission
+	bool _lazy = false;
+
+	// the method tables of proxies, by interface
+	std::unordered_map<rpcc_t, std::unique_ptr<rpc_binding>> _bindings;
+
+	// handler times, or null if not profiling
+	std::unique_ptr<handler_profile> _profile;
+
+	// the event simulator driving this network, if any
+	simulator* _sim = nullptr;
+
 	friend class host;
+	friend class executor;
+	friend class fanout_pool;
+	friend class simulator;
 
 
 	/**
@@ -659,9 +1586,15 @@ protected:
 		This method should not be confused with \c connect(). The \c connect() is the method
 		that should be called to construct the network. This method is called internally
 		by \c connect().
+
+		Channels returned by overloads are allocated by \c new, and they
+		are released by \c delete.
 	  */
 	virtual channel* create_channel(host* src, host* dest, rpcc_t rpcc) const;
 
+	// release a channel made by create_channel()
+	void free_channel(channel* c);
+
 public:
 
 	/** A default constructor */
@@ -675,6 +1608,8 @@ public:
 	{
 		all_hosts_group(network* _nw) : host_group(_nw) {}
 		size_t receivers(host* h) { return net()->_hosts.size()-1; }
+		void count_deliveries(host* sender, channel_counters& c, 
+			size_t msg_size) override;
 	};
 	all_hosts_group all_hosts;
 
@@ -690,6 +1625,228 @@ public:
 	/// The number or hosts
 	inline size_t size() const { return _hosts.size(); }
 
+	/**
+		The traffic counters of all channels, by channel id.
+
+		If counters are sharded, the shards are merged first.
+	  */
+	inline const channel_counters& counters() const { 
+		_counters.sync();
+		return _counters; 
+	}
+
+	/**
+		The traffic of an rpc endpoint, over all live channels whose
+		rpc code is exactly \c endp. Unlike a \c chan_frame query, 
+		this takes constant time.
+	  */
+	inline traffic_totals endpoint_traffic(rpcc_t endp) const {
+		_counters.sync();
+		return _counters.endp_totals(endp);
+	}
+
+	/// The traffic of a method, requests and responses
+	inline traffic_totals method_traffic(rpcc_t meth) const {
+		_counters.sync();
+		traffic_totals ret = _counters.endp_totals(meth & ~RPCC_RESP_MASK);
+		ret += _counters.endp_totals(meth | RPCC_RESP_MASK);
+		return ret;
+	}
+
+	/// The traffic of all methods of the interface of \c code
+	inline traffic_totals interface_traffic(rpcc_t code) const {
+		_counters.sync();
+		return _counters.ifc_totals(code);
+	}
+
+	/**
+		The traffic of a method, looked up in the rpc protocol.
+		It is zero for undeclared methods.
+	  */
+	traffic_totals method_traffic(const string& ifname, 
+		const string& mname) const;
+
+	/// The traffic of an interface, looked up in the rpc protocol
+	traffic_totals interface_traffic(const string& ifname) const;
+
+	/**
+		The traffic sent and received by the host at address \c a,
+		since the network was created (see \c channel_counters::by_host).
+		This takes constant time.
+	  */
+	inline traffic_totals host_traffic(host_addr a) const {
+		host* h = by_addr(a);
+		return h ? host_traffic(h) : traffic_totals();
+	}
+	inline traffic_totals host_traffic(host* h) const { 
+		size_t i = h->index();
+		_counters.sync();
+		return (i < _counters.by_host.size()) ? 
+			_counters.by_host[i] : traffic_totals();
+	}
+
+	/**
+		Report the \c k most loaded hosts of the network, where the 
+		load of a host is the number of messages it sent and received, 
+		or the number of bytes if \c by_bytes is true.
+		The skew statistics of the report cover all hosts.
+	  */
+	hotspot_report hotspots(size_t k, bool by_bytes = false) const;
+
+	/**
+		Enable or disable per-thread counter shards.
+
+		When enabled, each thread transmitting on channels of this network
+		accumulates traffic into its own shard, so that host logic can
+		run in parallel without contention or races on the counters. The
+		shards are merged lazily, when counters are read. Counters must
+		not be read while other threads are transmitting.
+
+		Creating and destroying channels must still be done by a single
+		thread.
+	  */
+	void set_sharded_counters(bool enable);
+
+	/// True if counters are sharded
+	inline bool sharded_counters() const { return bool(_counters.shards); }
+
+	/**
+		Enable windowed traffic counters, retaining the last 
+		\c nwindows epochs. Passing 0 disables them. Re-enabling 
+		discards previous windows.
+
+		Windowed counters cannot be combined with sharded counters.
+	  */
+	void set_windows(size_t nwindows);
+
+	/// The windowed counters, or null if disabled
+	inline const traffic_windows* windows() const { 
+		return _counters.windows.get(); 
+	}
+
+	/**
+		Advance the epoch of windowed counters. This is a no-op 
+		if windows are disabled.
+	  */
+	inline void tick() { if(_counters.windows) _counters.windows->tick(); }
+
+	/**
+		Trace every transmission to a trace writer (see dsarch_trace.hh).
+		Passing null stops tracing. The writer is not owned by the network.
+
+		Tracing cannot be combined with sharded counters.
+	  */
+	void set_trace(trace_writer* tw);
+
+	/// The current trace writer, or null
+	inline trace_writer* trace() const { return _counters.trace; }
+
+	/**
+		Enable or disable the profiling of remote call handlers (see
+		\c handler_profile). Re-enabling discards previous times.
+
+		Profiling cannot be toggled while an executor or a fan-out
+		pool is attached, since their threads may be timing handlers;
+		this throws \c std::logic_error.
+
+		Handlers are only timed if the library is configured with
+		\c --enable-profile.
+	  */
+	void set_handler_profiling(bool enable);
+
+	/// The handler times, or null if not profiling
+	inline handler_profile* handler_profiling() const { return _profile.get(); }
+
+	/**
+		The handler times of a method, or null if not profiling
+		or if no handler of the method has been timed. The method is 
+		looked up in the rpc protocol.
+	  */
+	const time_histogram* handler_times(const string& ifname, 
+		const string& mname) const;
+
+	/**
+		The handler times of all the methods of an interface, or an 
+		empty histogram if not profiling.
+	  */
+	time_histogram handler_times(const string& ifname) const;
+
+	/**
+		The executor running the hosts of this network, or null
+		if remote calls are executed synchronously.
+	  */
+	inline executor* exec() const { return _exec; }
+
+	/**
+		The pool running multicast handlers in parallel, or null
+		if they run sequentially.
+	  */
+	inline fanout_pool* fanout() const { return _fanout; }
+
+	/**
+		Set the codec used to size the messages of remote calls.
+
+		By default, messages are sized by the \c byte_size() estimates.
+		The codec should be set before any traffic is generated.
+	  */
+	inline void set_codec(wire_codec c) { _codec = c; }
+
+	/// The codec used to size the messages of remote calls
+	inline wire_codec codec() const { return _codec; }
+
+	/**
+		Enable or disable lazy channels.
+
+		By default, connecting a proxy creates the channels of all
+		the methods of its interface. With lazy channels, a channel is
+		created when a call first transmits on it, so that endpoints
+		that are never used cost nothing and do not appear in 
+		statistics.
+
+		Since channels are created during calls, lazy channels cannot
+		be combined with an executor or a fan-out pool. The setting
+		applies to proxies connected after it is changed.
+	  */
+	void set_lazy_channels(bool enable);
+
+	/// True if channels are created on first transmission
+	inline bool lazy_channels() const { return _lazy; }
+
+	/// The empty method table of an interface
+	const rpc_binding* bind_interface(rpcc_t ifc);
+
+	/**
+		The method table extending \c b by a method. This declares
+		the method in the interface of \c b.
+	  */
+	const rpc_binding* bind_method(const rpc_binding* b, const string& name,
+		bool one_way, rpc_binding::erased_method meth);
+
+	/**
+		The arena allocating the channels and proxies of this network.
+
+		The default \c create_channel() allocates channels in the
+		arena, and proxies allocate their channel slots in it.
+	  */
+	inline slab_arena& arena() { return _arena; }
+
+	/**
+		The discrete-event simulator driving this network, or null
+		if remote calls are delivered immediately.
+	  */
+	inline simulator* sim() const { return _sim; }
+
+	/// The attributes of all channels, by channel id
+	inline const channel_attrs& attrs() const { return _attrs; }
+
+	/**
+		Return the channel with the given id, or null if
+		there is no such channel.
+	  */
+	inline channel* channel_by_id(size_t cid) const { 
+		return cid < _chan_by_id.size() ? _chan_by_id[cid] : nullptr; 
+	}
+
 	/**
 		Declare an interface by name.
 
@@ -742,6 +1899,10 @@ public:
 	/**
 		Create a new RPC channel.
 
+		If a channel with the same source, destination and rpc code
+		already exists, it is returned instead. Lookup is done through
+		a hashed index, in O(1) expected time.
+
 		@param src the source host
 		@param dst the destination host
 		@param rpcc the endpoint code
@@ -750,41 +1911,594 @@ public:
 	channel* connect(host* src, host* dest, rpcc_t rpcc);
 
 	/**
-		Destroy an RPC channel.
+		Destroy an RPC channel.
+	  */
+	void disconnect(channel* c);
+
+
+	/**
+		Assign an address to a host. 
+
+		If `a` is a specific address, the call will assign `a` if available, else
+		it will return `false`.
+
+		If `a` is unknown_addr, then the call will assign a legal address and return
+		`true`.
+	  */
+	bool assign_address(host* h, host_addr a);
+
+
+	/**
+		Reserve all addresses in the range between 0 and a.
+
+		If `a` is non-negative, this call reserves addresses for hosts.
+		If `a` is negative, this call reserves addresses for groups.
+
+		These adresses are 'reserved' in the sense that they will not be 
+		automatically assigned to a host. They are still available after
+		this call, if they where available before the call
+	  */
+	void reserve_addresses(host_addr a);
+
+	/**
+		Get a host by the address if it exists.
+
+		If no host exists with this address, this function returns null.
+	  */
+	host* by_addr(host_addr a) const;
+};
+
+
+
+/*	----------------------------------------
+
+	Parallel execution
+
+	--------------------------------------- */
+
+
+/**
+	The work queue of a host.
+
+	Tasks posted to a host are executed in order, and never concurrently
+	with each other.
+  */
+struct host_mailbox
+{
+	std::mutex mtx;
+	std::deque<std::function<void()>> tasks;
+	bool scheduled = false;
+};
+
+
+/**
+	A parallel executor for the hosts of a network.
+
+	By default, remote calls are executed synchronously on the 
+	caller's thread. When an executor is attached to a network,
+	one-way remote calls (including multicast calls) are instead
+	posted to the mailbox of the destination host, and executed
+	by a pool of worker threads. 
+
+	Each host is executed serially: at most one worker processes 
+	the tasks of a host at any time, in the order they were posted.
+	Hosts with pending tasks are scheduled on per-worker deques, and
+	idle workers steal work from the other workers.
+
+	Two-way remote calls are serialized with the destination's other
+	tasks (see \c call()): if the destination is idle, the call runs
+	on the caller's thread, else it is posted and the caller waits for
+	the result. Calls can be nested, as in synchronous execution: a 
+	host waiting for a call can be called back by the callee, directly
+	or indirectly. However, two hosts that call each other from
+	unrelated tasks, at the same time, deadlock.
+
+	Arguments of one-way calls are copied into the posted task; 
+	pointers passed via \c msgwrapper must outlive the call.
+
+	Attaching an executor enables sharded counters on the network (see
+	\c network::set_sharded_counters()), so that channel accounting 
+	remains exact. Creating hosts and channels while the executor is 
+	running tasks is not supported.
+  */
+class executor
+{
+public:
+	typedef std::function<void()> task;
+
+	/**
+		Attach a new executor to a network.
+
+		@param nw the network
+		@param nthreads the number of worker threads (default is
+			the hardware concurrency)
+	  */
+	executor(network* nw, size_t nthreads=0);
+
+	/**
+		Wait for all tasks to complete and detach from the network.
+	  */
+	~executor();
+
+	/// The number of worker threads
+	inline size_t size() const { return workers.size(); }
+
+	/// The network of this executor
+	inline network* net() const { return nw; }
+
+	/**
+		Post a task to be executed by a host.
+
+		This can be called from any thread, including from tasks.
+	  */
+	void post(host* h, task&& t);
+
+	/**
+		Execute a task by a host, and wait for it to complete. If the
+		task throws, the exception is rethrown.
+
+		If the host has no pending tasks, the task is executed on the
+		calling thread. If the host is waiting, directly or indirectly,
+		for the caller, the task is also executed on the calling thread,
+		as a nested call. Otherwise, the task is posted, and the caller
+		waits; a worker that waits is replaced by a helper thread, so 
+		that the executor keeps its parallelism.
+
+		This can be called from any thread, including from tasks.
+	  */
+	void call(host* h, const task& t);
+
+	/**
+		Wait until all posted tasks (including tasks posted by tasks)
+		have completed. 
+
+		If a task has thrown an exception, the first such exception
+		is rethrown.
+	  */
+	void wait();
+
+private:
+	struct alignas(64) worker {
+		std::mutex mtx;
+		std::deque<host_mailbox*> ready;
+		std::thread thread;
+	};
+
+	network* nw;
+	vector<std::unique_ptr<worker>> workers;
+
+	// mailboxes, created on first use
+	std::mutex mbox_mtx;
+	vector<std::unique_ptr<host_mailbox>> mailboxes;
+
+	// external submissions, and idle workers
+	std::mutex idle_mtx;
+	std::condition_variable idle_cv;
+	std::deque<host_mailbox*> injected;
+	std::atomic<size_t> nready { 0 };
+	std::atomic<size_t> nsleeping { 0 };
+	bool stopping = false;
+
+	// helper threads, replacing workers blocked in call()
+	std::mutex helper_mtx;
+	vector<std::thread> helpers;
+	std::atomic<size_t> nblocked { 0 };
+
+	// quiescence
+	std::atomic<size_t> pending { 0 };
+	std::mutex done_mtx;
+	std::condition_variable done_cv;
+	std::exception_ptr error;
+
+	host_mailbox* mailbox(host* h);
+	void schedule(host_mailbox* mb);
+	host_mailbox* next_ready(size_t self);
+	void release(host_mailbox* mb);
+	void drain(host_mailbox* mb);
+	void run(size_t self);
+};
+
+
+/**
+	A thread pool for parallel multicast fan-out.
+
+	By default, a one-way multicast call executes the handlers of the
+	group members one after the other. When a fan-out pool is attached
+	to a network, synchronous multicast calls to groups of at least
+	\c min_group members instead partition the members into contiguous
+	blocks, which are executed concurrently by the pool's threads and
+	the calling thread. The call returns when all handlers have returned.
+
+	The accounting on the multicast channel is unchanged. Handlers that
+	only modify the state of their own host give the same results as 
+	sequential fan-out. Handlers must not change the membership of the
+	group. If handlers throw, all blocks are still executed, and the 
+	exception of the first failing block (in member order) is rethrown.
+
+	Calls made under an executor or a simulator are deferred as usual,
+	and do not use the pool. Multicast calls made by handlers running
+	in the pool are executed sequentially.
+
+	Like \c executor, attaching a pool enables sharded counters on the
+	network, so that handlers may transmit on other channels.
+  */
+class fanout_pool
+{
+public:
+	/**
+		Attach a new pool to a network.
+
+		@param nw the network
+		@param nthreads the number of threads, besides the caller's
+			(default is the hardware concurrency minus one)
+		@param min_group the smallest group fanned out in parallel
+	  */
+	fanout_pool(network* nw, size_t nthreads=0, size_t min_group=1024);
+
+	/// Detach from the network
+	~fanout_pool();
+
+	/// The number of pool threads
+	inline size_t size() const { return threads.size(); }
+
+	/// The network of this pool
+	inline network* net() const { return nw; }
+
+	/// The smallest group fanned out in parallel
+	inline size_t min_group() const { return mingrp; }
+
+	/**
+		Execute \c body(from, to) over a partition of [0, n) into
+		contiguous blocks, in parallel.
+
+		If called from a pool thread, or while another thread is 
+		running a fan-out, the blocks are executed sequentially by the
+		caller.
+	  */
+	void run(size_t n, const std::function<void(size_t, size_t)>& body);
+
+private:
+	struct job;
+
+	network* nw;
+	size_t mingrp;
+	vector<std::thread> threads;
+
+	std::mutex run_mtx;		// held by the thread running a fan-out
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::shared_ptr<job> current;
+	uint64_t generation = 0;
+	bool stopping = false;
+
+	void work(job& j);
+	void loop();
+};
+
+
+
+/*	----------------------------------------
+
+	Discrete-event simulation
+
+	--------------------------------------- */
+
+
+/**
+	Virtual time, in arbitrary units (ticks).
+  */
+typedef uint64_t sim_time;
+
+
+/**
+	A monotone priority queue of integer keys.
+
+	This is a radix heap: items are kept in 65 buckets, according to
+	the highest bit in which their key differs from the last key popped.
+	Pushes are O(1) and pops are amortized O(log C), where C is the key 
+	range. Keys pushed must not be smaller than the last key popped,
+	which always holds for event times.
+
+	Items with equal keys are popped in the order they were pushed.
+  */
+template <typename Value>
+class radix_heap
+{
+	typedef std::pair<uint64_t, Value> item;
+	vector<item> buckets[65];
+	size_t head = 0;		// the next item in bucket 0
+	uint64_t last = 0;
+	size_t count = 0;
+
+	static inline int bucket_of(uint64_t key, uint64_t last) {
+		return key==last ? 0 : 64 - __builtin_clzll(key ^ last);
+	}
+
+	void refill() {
+		buckets[0].clear();
+		head = 0;
+		int i = 1;
+		while(buckets[i].empty()) i++;
+
+		uint64_t newlast = buckets[i][0].first;
+		for(auto& x : buckets[i])
+			if(x.first < newlast) newlast = x.first;
+		last = newlast;
+
+		// items are moved to empty buckets, in order
+		for(auto& x : buckets[i])
+			buckets[bucket_of(x.first, last)].push_back(std::move(x));
+		buckets[i].clear();
+	}
+public:
+	inline size_t size() const { return count; }
+	inline bool empty() const { return count==0; }
+
+	/// The last key popped (or 0)
+	inline uint64_t last_key() const { return last; }
+
+	inline void push(uint64_t key, const Value& v) {
+		assert(key >= last);
+		buckets[bucket_of(key, last)].emplace_back(key, v);
+		count++;
+	}
+
+	/// The smallest key; the heap must not be empty
+	inline uint64_t top_key() {
+		if(head == buckets[0].size()) refill();
+		return buckets[0][head].first;
+	}
+
+	/// Pop the item with the smallest key; the heap must not be empty
+	inline item pop() {
+		if(head == buckets[0].size()) refill();
+		count--;
+		return std::move(buckets[0][head++]);
+	}
+
+	void clear() {
+		for(auto& b : buckets) b.clear();
+		head = 0; last = 0; count = 0;
+	}
+};
+
+
+/**
+	An action to be executed by an event.
+
+	Small callables are stored inline, avoiding heap allocation for
+	the common case of remote call delivery.
+  */
+class sim_action
+{
+	static constexpr size_t inline_size = 56;
+	alignas(std::max_align_t) unsigned char buf[inline_size];
+	void (*fire)(sim_action*) = nullptr;
+	void (*drop)(sim_action*) = nullptr;
+
+	template <typename Fn>
+	struct guard {
+		Fn* fn; bool owned;
+		~guard() { if(owned) delete fn; else fn->~Fn(); }
+	};
+public:
+	sim_action() {}
+	sim_action(const sim_action&) = delete;
+	sim_action& operator=(const sim_action&) = delete;
+	~sim_action() { if(drop) drop(this); }
+
+	inline bool empty() const { return fire==nullptr; }
+
+	/// Store a callable in this (empty) action
+	template <typename F>
+	void set(F&& f) {
+		typedef typename std::decay<F>::type Fn;
+		assert(empty());
+		if constexpr (sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t)) {
+			new(buf) Fn(std::forward<F>(f));
+			fire = [](sim_action* a) {
+				a->fire = a->drop = nullptr;
+				guard<Fn> g { reinterpret_cast<Fn*>(a->buf), false };
+				(*g.fn)();
+			};
+			drop = [](sim_action* a) {
+				reinterpret_cast<Fn*>(a->buf)->~Fn();
+				a->fire = a->drop = nullptr;
+			};
+		} else {
+			Fn* p = new Fn(std::forward<F>(f));
+			*reinterpret_cast<Fn**>(buf) = p;
+			fire = [](sim_action* a) {
+				a->fire = a->drop = nullptr;
+				guard<Fn> g { *reinterpret_cast<Fn**>(a->buf), true };
+				(*g.fn)();
+			};
+			drop = [](sim_action* a) {
+				delete *reinterpret_cast<Fn**>(a->buf);
+				a->fire = a->drop = nullptr;
+			};
+		}
+	}
+
+	/// Execute and clear the action
+	inline void operator()() { fire(this); }
+
+	/// Clear the action without executing it
+	inline void clear() { if(drop) drop(this); }
+};
+
+
+/**
+	A model of channel latency.
+
+	The latency model decides the delivery time of each message.
+  */
+struct latency_model
+{
+	virtual ~latency_model();
+
+	/**
+		The delay of a message of \c msg_size bytes on channel \c c.
+	  */
+	virtual sim_time delay(const channel* c, size_t msg_size) const = 0;
+};
+
+
+/**
+	A linear latency model.
+
+	The delay of a message is \c base + \c per_byte * size. The base
+	latency can be overridden for individual channels.
+  */
+class linear_latency : public latency_model
+{
+	sim_time base, per_byte;
+	vector<sim_time> chan_base;		// by channel id, 0 means default
+public:
+	linear_latency(sim_time _base=1, sim_time _per_byte=0)
+	: base(_base), per_byte(_per_byte) {}
+
+	/// Set the base latency of a particular channel (must be positive)
+	void set_latency(const channel* c, sim_time lat);
+
+	sim_time delay(const channel* c, size_t msg_size) const override {
+		sim_time b = base;
+		if(c->id() < chan_base.size() && chan_base[c->id()] != 0) 
+			b = chan_base[c->id()];
+		return b + per_byte * msg_size;
+	}
+};
+
+
+/**
+	A discrete-event simulator for a network.
+
+	When a simulator is attached to a network, one-way remote calls 
+	(including multicast calls) are not executed immediately. Instead, 
+	the message is charged on the channel at send time, as usual, and 
+	a delivery event is scheduled at the current time plus the channel's
+	latency, according to the latency model. The handler of the call
+	is executed when the event is processed. 
+
+	Two-way remote calls are still executed synchronously, at the current
+	virtual time.
+
+	Events at the same time are processed in the order they were 
+	scheduled. User code can also schedule arbitrary events, e.g., to
+	model the arrival of stream records.
+  */
+class simulator
+{
+public:
+	/**
+		Attach a new simulator to a network.
+
+		The default latency model is \c linear_latency(1,0), i.e.,
+		every message is delivered after one tick.
+	  */
+	simulator(network* nw);
+
+	/**
+		Detach from the network, discarding pending events.
+
+		The actions of pending events are destroyed without being
+		executed. In particular, pending asynchronous calls fail: their
+		awaiting coroutines are resumed with a \c std::runtime_error.
+		Since the simulator is already detached, these coroutines cannot
+		make further asynchronous calls.
+	  */
+	~simulator();
+
+	/// The network of this simulator
+	inline network* net() const { return nw; }
+
+	/// The current virtual time
+	inline sim_time now() const { return _now; }
+
+	/// The number of pending events
+	inline size_t pending() const { return queue.size(); }
+
+	/// The number of events processed so far
+	inline size_t processed() const { return _processed; }
+
+	/// The latency model
+	inline latency_model& latency() const { return *_latency; }
+
+	/// Replace the latency model
+	void set_latency(latency_model* lm);
+
+	/**
+		Schedule an action at absolute time \c t, which must not be 
+		earlier than \c now().
 	  */
-	void disconnect(channel* c);
+	template <typename F>
+	inline void at(sim_time t, F&& f) {
+		if(t < _now)
+			throw std::invalid_argument("cannot schedule an event in the past");
+		size_t slot = alloc_slot();
+		action(slot).set(std::forward<F>(f));
+		queue.push(t, slot);
+	}
 
+	/// Schedule an action after \c dt ticks from now
+	template <typename F>
+	inline void after(sim_time dt, F&& f) { at(_now + dt, std::forward<F>(f)); }
 
 	/**
-		Assign an address to a host. 
-
-		If `a` is a specific address, the call will assign `a` if available, else
-		it will return `false`.
+		Schedule the delivery of a message transmitted on channel \c c.
+	  */
+	template <typename F>
+	inline void deliver(const channel* c, size_t msg_size, F&& f) {
+		after(_latency->delay(c, msg_size), std::forward<F>(f));
+	}
 
-		If `a` is unknown_addr, then the call will assign a legal address and return
-		`true`.
+	/**
+		Process the next event, if any. Returns false if there
+		are no pending events.
 	  */
-	bool assign_address(host* h, host_addr a);
+	bool step();
 
+	/**
+		Process events until there are no pending events.
+		Returns the number of events processed.
+	  */
+	size_t run();
 
 	/**
-		Reserve all addresses in the range between 0 and a.
+		Process all events up to (and including) time \c t, and
+		advance the clock to \c t. Returns the number of events processed.
+	  */
+	size_t run_until(sim_time t);
 
-		If `a` is non-negative, this call reserves addresses for hosts.
-		If `a` is negative, this call reserves addresses for groups.
+private:
+	network* nw;
+	sim_time _now = 0;
+	size_t _processed = 0;
+	std::unique_ptr<latency_model> _latency;
 
-		These adresses are 'reserved' in the sense that they will not be 
-		automatically assigned to a host. They are still available after
-		this call, if they where available before the call
-	  */
-	void reserve_addresses(host_addr a);
+	radix_heap<uint32_t> queue;
 
-	/**
-		Get a host by the address if it exists.
+	// slab of event actions, in chunks that are never moved
+	static constexpr size_t chunk_bits = 10;
+	vector<std::unique_ptr<sim_action[]>> chunks;
+	vector<uint32_t> free_slots;
 
-		If no host exists with this address, this function returns null.
-	  */
-	host* by_addr(host_addr a) const;
+	inline sim_action& action(size_t slot) {
+		return chunks[slot >> chunk_bits][slot & ((1<<chunk_bits)-1)];
+	}
+
+	inline size_t alloc_slot() {
+		if(free_slots.empty()) {
+			// add a chunk of free slots
+			size_t base = chunks.size() << chunk_bits;
+			chunks.emplace_back(new sim_action[1<<chunk_bits]);
+			for(size_t i = 1<<chunk_bits; i>0; i--)
+				free_slots.push_back(base+i-1);
+		}
+		size_t slot = free_slots.back();
+		free_slots.pop_back();
+		return slot;
+	}
 };
 
 
@@ -857,6 +2571,11 @@ struct Acknowledge
 	inline size_t byte_size() const { 
 		return is_ack ? dsarch::byte_size(payload) : 0;
 	}
+
+	template <typename Codec>
+	inline size_t encoded_size() const {
+		return is_ack ? dsarch::encoded_size<Codec>(payload) : 0;
+	}
 };
 
 /**
@@ -880,6 +2599,8 @@ constexpr Ack ACK(true);
 
 // An ACK message has a 0-byte payload */
 template <>
+struct fixed_byte_size<Ack> : byte_size_constant<0> {};
+template <>
 inline size_t byte_size< Ack >(const Ack& s) { return 0; }
 
 
@@ -896,17 +2617,32 @@ inline bool __transmit_response(const Acknowledge<T>& ackval) {
 	Compute the message size of an argument list.
 
 	This function simply adds the \c byte_size() value
-	of each argument.
+	of each argument. If all arguments have fixed byte sizes,
+	the size is a compile-time constant.
   */
 template <typename...Args>
-inline size_t message_size(const Args& ...args)
+constexpr inline size_t message_size(const Args& ...args)
 {
-	size_t total = 0;
-	typedef size_t swallow[];
-	(void) swallow {0,
-	 	(total+= byte_size(args))...
-	};
-	return total;
+	if constexpr (all_fixed_byte_size<Args...>)
+		return static_message_size<Args...>;
+	else
+		return (size_t(0) + ... + byte_size(args));
+}
+
+/**
+	Compute the message size of an argument list, under a codec.
+  */
+template <typename...Args>
+inline size_t message_size(wire_codec codec, const Args& ...args)
+{
+	switch(codec) {
+	case wire_codec::fixed:
+		return encoded_message_size<fixed_codec>(args...);
+	case wire_codec::varint:
+		return encoded_message_size<varint_codec>(args...);
+	default:
+		return message_size(args...);
+	}
 }
 
 template <typename Dest>
@@ -926,7 +2662,9 @@ struct remote_method;
 	- its _owner_ is an object of any class which is a subclass of host
 	- its _destination_ is an object of a subclass of \c Process
 
-	This is a typed subclass of \c rpc_proxy, with no attributes.
+	This is a typed subclass of \c rpc_proxy. The destination is 
+	converted to its type statically, so that remote calls do not need
+	to perform any RTTI work.
 
 	@tparam Process the base class for proxied objects.
   */
@@ -947,36 +2685,52 @@ public:
 		Connects this proxy to a destination.
 		This going to be a unicast proxy.
 	  */
-	inline void operator<<=(Process* dest) { _r_connect(dest); 	}
+	inline void operator<<=(Process* dest) { 
+		_r_connect(dest);
+		_r_mcast = false;
+	}
 
 	/**
 		Connects this proxy to a destination.
 		This going to be a unicast proxy.
 	  */
-	inline void operator<<=(Process& dest) { _r_connect(&dest); }
+	inline void operator<<=(Process& dest) { *this <<= &dest; }
 
 	/**
 		Connects this proxy to a destination.
 		This going to be a multicast proxy.
 	  */
-	inline void operator<<=(mcast_group<Process>* dest) { _r_connect(dest); 	}
+	inline void operator<<=(mcast_group<Process>* dest) { 
+		_r_connect(dest);
+		_r_mcast = true;
+	}
 
 	/**
 		Connects this proxy to a destination.
 		This going to be a multicast proxy.
 	  */
-	inline void operator<<=(mcast_group<Process>& dest) { _r_connect(&dest); }
+	inline void operator<<=(mcast_group<Process>& dest) { *this <<= &dest; }
 
 	/**
-		The process proxied by this proxy.
+		The process proxied by this proxy, or null if this is
+		a multicast proxy.
 	  */
 	inline Process* proc() const { 
-		return dynamic_cast<Process*>(_r_proc); 
+		return _r_mcast ? nullptr : static_cast<Process*>(_r_proc); 
 	}
 
-	inline mcast_group<Process>* proc_group() const {
-		return dynamic_cast<mcast_group<Process>*>(_r_proc); 		
+	/**
+		The group proxied by this proxy, or null if this is
+		a unicast proxy.
+	  */
+	inline mcast_group<Process>* proc_group() const { 
+		return _r_mcast ? static_cast<mcast_group<Process>*>(_r_proc) : nullptr; 
 	}
+
+	/**
+		True if this proxy has been connected to a group.
+	  */
+	inline bool is_multicast() const { return _r_mcast; }
 };
 
 
@@ -990,22 +2744,79 @@ struct proxy_method  : rpc_call
 {
 	typedef remote_proxy<Dest> proxy_type;
 	
-	inline proxy_type* proxy() const { return static_cast<proxy_type*>(_proxy); }
-
-	inline proxy_method(proxy_type* _proxy, bool one_way, const string& _name) 
-	: rpc_call(_proxy, one_way, _name) {}
+	inline proxy_type* proxy() const { return static_cast<proxy_type*>(this->_proxy()); }
+
+	template <typename Method>
+	inline proxy_method(proxy_type* _proxy, bool one_way, const string& _name,
+		Method meth) 
+	: rpc_call(_proxy, one_way, _name, 
+		reinterpret_cast<rpc_binding::erased_method>(meth)) {}
+
+	/// The member function of the destination called by this method
+	template <typename Method>
+	inline Method method_as() const { 
+		return reinterpret_cast<Method>(this->info().method); 
+	}
 
 	inline void transmit_request(size_t msg_size) const {
-		this->request_channel()->transmit(msg_size);		
+		this->open_request()->transmit(msg_size);		
 	}
 
 	inline void transmit_response(size_t msg_size) const {
-		this->response_channel()->transmit(msg_size);		
+		this->open_response()->transmit(msg_size);		
 	}	
+
+	/// The size of a message, under the codec of the network
+	template <typename...T>
+	inline size_t wire_size(const T&...x) const {
+		return message_size(this->proxy()->_r_owner->net()->codec(), x...);
+	}
 };
 
 
 
+/**
+	Times a handler invocation, for its lifetime, if the network is
+	profiling handlers (see \c handler_profile). 
+	
+	Unless the library is configured with \c --enable-profile, this is
+	an empty object. Since the setting comes from \c dsarch_config.hh,
+	every file of a build sees the same layout.
+  */
+struct handler_timer
+{
+#ifdef DSARCH_PROFILE
+	handler_profile* prof;
+	rpcc_t endp;
+	uint64_t start;
+
+	inline handler_timer(network* nw, rpcc_t _endp) 
+	: prof(nw->handler_profiling()), endp(_endp), 
+	  start(prof ? tick_clock::now() : 0) 
+	{ }
+
+	inline handler_timer(const rpc_call& call) 
+	: prof(call._proxy()->_r_owner->net()->handler_profiling()) 
+	{
+		if(prof) {
+			endp = call.endpoint();
+			start = tick_clock::now();
+		}
+	}
+
+	inline ~handler_timer() {
+		if(prof) prof->record(endp, tick_clock::now() - start);
+	}
+
+	handler_timer(const handler_timer&) = delete;
+	handler_timer& operator=(const handler_timer&) = delete;
+#else
+	inline handler_timer(network*, rpcc_t) {}
+	inline handler_timer(const rpc_call&) {}
+#endif
+};
+
+
 template <typename Dest, typename Response, typename ... Args>
 struct remote_method;
 
@@ -1015,25 +2826,44 @@ template <typename Dest, typename Response, typename ... Args>
 struct remote_method : proxy_method<Dest>
 {
 	typedef	Response (Dest::* method_type)(Args...);
-	method_type method;
 
 	remote_method(remote_proxy<Dest>* _proxy, method_type _meth, const string& _name)
-	: proxy_method<Dest>(_proxy, false, _name), 
-		method(_meth) 
+	: proxy_method<Dest>(_proxy, false, _name, _meth)
 	{ }
 
+	/// The method of the destination
+	inline method_type method() const { 
+		return this->template method_as<method_type>(); 
+	}
+
 	inline Response operator()(Args...args) const
 	{
 		Dest* target = this->proxy()->proc();
 		assert(target);
-		this->transmit_request(message_size(args...));
-		Response r = (target->* (this->method))(
-			std::forward<Args>(args)...
-			);
+		this->transmit_request(this->wire_size(args...));
+		Response r = invoke(target, std::forward<Args>(args)...);
 		if( __transmit_response(r) )
-			this->transmit_response(message_size(r));
+			this->transmit_response(this->wire_size(r));
 		return r;
 	}
+
+private:
+	// run the handler, on the destination's mailbox if there is 
+	// an executor
+	inline Response invoke(Dest* target, Args&&... args) const
+	{
+		executor* ex = this->proxy()->_r_owner->net()->exec();
+		if(ex == nullptr) {
+			handler_timer timer(*this);
+			return (target->* (this->method()))(std::forward<Args>(args)...);
+		}
+		std::optional<Response> r;
+		ex->call(target, [&]() {
+			handler_timer timer(*this);
+			r.emplace((target->* (this->method()))(std::forward<Args>(args)...));
+		});
+		return std::move(*r);
+	}
 };
 
 
@@ -1041,32 +2871,97 @@ template <typename Dest, typename ... Args>
 struct remote_method<Dest, void, Args...> : proxy_method<Dest>
 {
 	typedef	void (Dest::* method_type)(Args...);
-	method_type method;
 
 	remote_method(remote_proxy<Dest>* _proxy, method_type _meth, const string& _name)
-	: proxy_method<Dest>(_proxy, true, _name), method(_meth) 
+	: proxy_method<Dest>(_proxy, true, _name, _meth)
 	{ }
 
+	/// The method of the destination
+	inline method_type method() const { 
+		return this->template method_as<method_type>(); 
+	}
+
 	inline void operator()(Args...args) const
 	{
+		// When running under an executor or a simulator, the 
+		// calls are deferred
+		network* nw = this->proxy()->_r_owner->net();
+		const bool deferred = nw->exec() || nw->sim();
+
 		// Here we must distinguish the case of having a unicast or
 		// multicast call
-
-		// Try the unicast case first, as it is probably more common
-		Dest* utarget = this->proxy()->proc();
-		if(utarget!=nullptr) {
+		if(! this->proxy()->is_multicast()) {
 			// unicast case
-			this->transmit_request(message_size(args...));
-			(utarget->* (this->method))(	std::forward<Args>(args)...	);
+			Dest* utarget = this->proxy()->proc();
+			assert(utarget);
+			size_t msize = this->wire_size(args...);
+			this->transmit_request(msize);
+			if(deferred) 
+				defer(nw, utarget, msize, args...);
+			else {
+				handler_timer timer(*this);
+				(utarget->* (this->method()))(	std::forward<Args>(args)...	);
+			}
 		} else {
 			mcast_group<Dest>* mtarget = this->proxy()->proc_group();
 			assert(mtarget);
-			this->transmit_request(message_size(args...));
+			size_t msize = this->wire_size(args...);
+			this->transmit_request(msize);
 			// issue the calls
-			for(Dest* target : *mtarget) 			
-				(target->* (this->method))(	std::forward<Args>(args)...	);
+			fanout_pool* pool = nw->fanout();
+			if(deferred) {
+				for(Dest* target : *mtarget)
+					defer(nw, target, msize, args...);
+			} else if(pool && mtarget->size() >= pool->min_group()) {
+				// handlers run in parallel, so they must not change
+				// the membership (see mcast_group)
+				const auto& memb = mtarget->members();
+				const size_t n = memb.size();
+				method_type m = this->method();
+				pool->run(n, [&](size_t from, size_t to) {
+					for(size_t i=from; i<to; i++) {
+						handler_timer timer(*this);
+						(memb[i]->* m)(args...);
+					}
+				});
+				assert(memb.size() == n);
+			} else {
+				// Handlers may join or leave the group, which moves
+				// members, so iterate over the host indices at the 
+				// start of the call. Indices are never reused, so a 
+				// host that left is skipped without touching it.
+				const vector<uint32_t> snap(mtarget->member_indices());
+				for(uint32_t i : snap) {
+					Dest* target = mtarget->member(i);
+					if(target == nullptr) continue;
+					handler_timer timer(*this);
+					(target->* (this->method()))(args...);
+				}
+			}
 		}
 	}
+
+private:
+	// post a copy of the call to the executor, or schedule its
+	// delivery in the simulator
+	inline void defer(network* nw, Dest* target, size_t msize, 
+		const Args&... args) const
+	{
+		method_type m = this->method();
+#ifdef DSARCH_PROFILE
+		rpcc_t endp = this->endpoint();
+		auto call = [=]() { 
+			handler_timer timer(nw, endp); 
+			(target->* m)(args...); 
+		};
+#else
+		auto call = [=]() { (target->* m)(args...); };
+#endif
+		if(executor* ex = nw->exec())
+			ex->post(target, std::move(call));
+		else
+			nw->sim()->deliver(this->request_channel(), msize, std::move(call));
+	}
 };
 
 
@@ -1114,6 +3009,11 @@ struct call_context {
 	size_t byte_size() const { return 0; }
 };
 
+/// Call contexts are free of cost
+template <typename T>
+struct fixed_byte_size<T, std::enable_if_t<std::is_base_of_v<call_context, T>>>
+: byte_size_constant<0> {};
+
 
 /**
 	Passing a pointer to the sender of a message as context.
@@ -1145,7 +3045,12 @@ struct msgwrapper
 {
 	T* payload;
 	msgwrapper(T* _p) : payload(_p){}
-	inline size_t byte_size() const { return byte_size((const T&) *payload); }
+	inline size_t byte_size() const { return dsarch::byte_size((const T&) *payload); }
+
+	template <typename Codec>
+	inline size_t encoded_size() const { 
+		return dsarch::encoded_size<Codec>((const T&) *payload); 
+	}
 };
 
 /**
@@ -1167,6 +3072,17 @@ msgwrapper<T> wrap(T& p) { return msgwrapper<T>(&p); }
 
 	Each site maintaining a set of proxies on a number of objects, can
 	use a proxy map store pointers to its proxies.
+
+	Proxies are indexed by the address of their destination, in an
+	open-addressing hash table kept at most half full. Thus, lookup 
+	takes constant expected time, and the index takes space 
+	proportional to the number of proxies, however sparse the 
+	addresses are.
+
+	The proxies themselves are stored contiguously, in blocks that are
+	never moved. Adding proxies one at a time allocates blocks of 
+	geometrically increasing size. \c add_sites() allocates a single
+	block for all the new proxies of a container.
  */
 template <typename ProxyType, typename ProxiedType = typename ProxyType::proxied_type>
 class proxy_map
@@ -1185,15 +3101,18 @@ public:
 	  */
 	proxy_map(host* _owner) : owner(_owner) {  }
 
+	proxy_map(const proxy_map&) = delete;
+	proxy_map& operator=(const proxy_map&) = delete;
+
 	/**
 		Destroy proxy map and all proxies it created
 	  */
 	~proxy_map() {
-		// remove the proxies 
-		for(auto m : pmap)
-			delete m.second;
-		for(auto m : mpmap)
-			delete m.second;
+		for(auto b = blocks.rbegin(); b != blocks.rend(); ++b) {
+			for(size_t i = b->used; i>0; i--)
+				b->base[i-1].~proxy_type();
+			::operator delete(b->base, std::align_val_t(alignof(proxy_type)));
+		}
 	}
 
 	/**
@@ -1208,51 +3127,142 @@ public:
 	proxy_type& operator[](mcast_group<proxied_type>* mproc) { return * add(mproc); }
 	proxy_type& operator[](mcast_group<proxied_type>& mproc) { return * add(&mproc); }
 
+	/**
+		The proxy to the host with the given address, or null if the 
+		map does not contain one.
+	  */
+	proxy_type* find(host_addr a) const {
+		if(count == 0) return nullptr;
+		return table[probe(a)].prx;
+	}
+
+	/**
+		The number of proxies in the map
+	  */
+	inline size_t size() const { return count; }
+
 	/**
 		Add a process to the proxy map, creating its proxy.
 	  */
 	proxy_type* add(proxied_type* proc) {
-		if(owner==nullptr)
-			throw std::runtime_error("Proxy map has not been owned yet.");
-		auto it =  pmap.find(proc);
-		if(it!=pmap.end()) return it->second;
-		proxy_type* prx = new proxy_type(owner);
-		*prx <<= proc;
-		pmap[proc] = prx;
-		return prx;
+		return insert(proc, proc);
 	}
 
 	/** 
 		Add a mcast_group to the map.
 	  */
 	proxy_type* add(mcast_group<proxied_type>* mproc) {
-		if(owner==nullptr)
-			throw std::runtime_error("Proxy map has not been owned yet.");
-		auto it =  mpmap.find(mproc);
-		if(it!=mpmap.end()) return it->second;
-		proxy_type* prx = new proxy_type(owner);
-		*prx <<= mproc;
-		mpmap[mproc] = prx;
-		return prx;
+		return insert(mproc, mproc);
 	}
 
 	/**
 		Add proxies to all sites in a container of sites.
 
 		It the owner is a member of the container, it will be
-		excluded.
+		excluded. Storage for all new proxies is allocated 
+		beforehand, and the index is grown once.
 	  */
 	template <typename SiteContainer>
 	void add_sites(const SiteContainer& sites) {
+		if(owner==nullptr)
+			throw std::runtime_error("Proxy map has not been owned yet.");
+
+		// count the new proxies (an upper bound, with duplicates)
+		size_t n = 0;
+		for(auto&& h : sites) {
+			host* s = h;
+			if(s != owner && find(s->addr()) == nullptr) n++;
+		}
+		if(n > 0) {
+			reserve(n);
+			rehash(count + n);
+		}
+
 		for(auto&& h : sites) 
 			if(h != owner) add(h);
 	}
 
+	/**
+		Make room for n more proxies in the current block.
+	  */
+	void reserve(size_t n) {
+		if(blocks.empty() || blocks.back().cap - blocks.back().used < n) {
+			block b;
+			b.base = static_cast<proxy_type*>(::operator new(n*sizeof(proxy_type),
+				std::align_val_t(alignof(proxy_type))));
+			b.cap = n;
+			blocks.push_back(b);
+		}
+	}
 
 private:
+	struct block
+	{
+		proxy_type* base;
+		size_t used = 0;
+		size_t cap = 0;
+	};
+
+	struct slot
+	{
+		host_addr addr;
+		proxy_type* prx = nullptr;	// null if the slot is empty
+	};
+
 	host* owner;
-	std::map<proxied_type*, proxy_type*> pmap;
-	std::map<mcast_group<proxied_type>*, proxy_type*> mpmap;
+	size_t count = 0;
+	vector<slot> table;		// a power of 2 in size, at most half full
+	int shift = 64;			// 64 - log2(table.size())
+	vector<block> blocks;
+
+	// the slot of address a, or the empty slot where it would go
+	inline size_t probe(host_addr a) const {
+		const size_t mask = table.size()-1;
+		size_t i = (uint64_t(uint32_t(a)) * 0x9E3779B97F4A7C15ull) >> shift;
+		while(table[i].prx != nullptr && table[i].addr != a)
+			i = (i+1) & mask;
+		return i;
+	}
+
+	// make room for n proxies in the index
+	void rehash(size_t n) {
+		if(2*n <= table.size()) return;
+		size_t sz = 16;
+		int sh = 60;
+		while(sz < 2*n) { sz *= 2; sh--; }
+		vector<slot> prev(sz);
+		prev.swap(table);
+		shift = sh;
+		for(const slot& s : prev)
+			if(s.prx != nullptr) table[probe(s.addr)] = s;
+	}
+
+	template <typename Dest>
+	proxy_type* insert(host* h, Dest* dest) {
+		if(owner==nullptr)
+			throw std::runtime_error("Proxy map has not been owned yet.");
+		host_addr a = h->addr();
+		rehash(count+1);
+		size_t i = probe(a);
+		if(table[i].prx != nullptr) 
+			return table[i].prx;
+
+		if(blocks.empty() || blocks.back().used == blocks.back().cap)
+			reserve(std::max<size_t>(16, count));
+		block& b = blocks.back();
+		proxy_type* prx = new (b.base + b.used) proxy_type(owner);
+		b.used++;
+		try {
+			*prx <<= dest;
+		} catch(...) {
+			prx->~proxy_type();
+			b.used--;
+			throw;
+		}
+		table[i] = slot { a, prx };
+		count++;
+		return prx;
+	}
 };
 
 
@@ -1309,44 +3319,53 @@ struct chan_frame : vector<channel*>
 		return ret;		
 	}
 
-	// total messages over all channels
-	inline size_t msgs() const {
+	// sum a counter column over the channels of the frame
+	inline size_t column_sum(vector<size_t> channel_counters::* col) const {
+		if(empty()) return 0;
+		const vector<size_t>& column = 
+			front()->source()->net()->counters().*col;
 		size_t ret=0;
-		for(auto c : *this) ret += c->messages();
+		for(auto c : *this) ret += column[c->id()];
 		return ret;
 	}
 
+	// total messages over all channels
+	inline size_t msgs() const { return column_sum(&channel_counters::msgs); }
+
 	// total bytes over all channels
-	inline size_t bytes() const {
-		size_t ret=0;
-		for(auto c:*this) ret += c->bytes();
-		return ret;
+	inline size_t bytes() const { return column_sum(&channel_counters::byts); }
+
+	// total received messages over broadcast channels
+	inline size_t recv_msgs() const { 
+		return column_sum(&channel_counters::rxmsgs); 
 	}
 
+	// total received bytes over broadcast channels
+	inline size_t recv_bytes() const { 
+		return column_sum(&channel_counters::rxbyts); 
+	}
 
-	// total received messages over broadcast channels
-	inline size_t recv_msgs() const {
-		size_t ret=0;
-		for(auto c : *this) {
-			multicast_channel* bc = dynamic_cast<multicast_channel*>(c);
-			if(bc!=nullptr)
-				ret += c->messages_received();
-		}
+	// total messages in epochs [from, to), if windows are enabled
+	inline size_t msgs(size_t from, size_t to) const {
+		const traffic_windows* tw = windows();
+		size_t ret = 0;
+		if(tw) for(auto c : *this) ret += tw->msgs(c->id(), from, to);
 		return ret;
 	}
 
-
-	// total received bytes over broadcast channels
-	inline size_t recv_bytes() const {
-		size_t ret=0;
-		for(auto c : *this) {
-			multicast_channel* bc = dynamic_cast<multicast_channel*>(c);
-			if(bc!=nullptr)
-				ret += c->bytes_received();
-		}
+	// total bytes in epochs [from, to), if windows are enabled
+	inline size_t bytes(size_t from, size_t to) const {
+		const traffic_windows* tw = windows();
+		size_t ret = 0;
+		if(tw) for(auto c : *this) ret += tw->bytes(c->id(), from, to);
 		return ret;
 	}
 
+	// the windowed counters of the network
+	inline const traffic_windows* windows() const {
+		return empty() ? nullptr : front()->source()->net()->windows();
+	}
+
 
 	//
 	//
@@ -1421,10 +3440,10 @@ struct chan_frame : vector<channel*>
 
 	// By remote method (rpc_method)
 	chan_frame endp(const type_info& ti, const string& mname) const {
-		return endp(rpc().code(ti, mname), RPCC_IFC_MASK);
+		return endp(rpc().code(ti, mname), RPCC_IFC_MASK|RPCC_METH_MASK);
 	}
 	chan_frame endp(const string& ifname, const string& mname) const {
-		return endp(rpc().code(ifname, mname), RPCC_IFC_MASK);
+		return endp(rpc().code(ifname, mname), RPCC_IFC_MASK|RPCC_METH_MASK);
 	}
 
 	// By endpoint direction
@@ -1454,5 +3473,237 @@ struct chan_frame : vector<channel*>
 };
 
 
+/**
+	A read-only view of the channel columns of a network.
+
+	This collects pointers to the \c channel_attrs and 
+	\c channel_counters columns, so that columnar queries can be 
+	evaluated over different storage, e.g., memory-mapped snapshots.
+	The attribute columns have \c slots entries (a multiple of 64), the 
+	counter columns have \c counters entries.
+  */
+struct chan_columns
+{
+	size_t slots = 0;
+	const uint64_t* live = nullptr;
+	const host_addr* src = nullptr;
+	const host_addr* dst = nullptr;
+	const rpcc_t* rpcc = nullptr;
+	const uint8_t* mcast = nullptr;
+
+	size_t counters = 0;
+	const size_t* msgs = nullptr;
+	const size_t* byts = nullptr;
+	const size_t* rxmsgs = nullptr;
+	const size_t* rxbyts = nullptr;
+
+	const rpc_protocol* rpc = &rpc_protocol::empty;
+
+	chan_columns() {}
+
+	/// The columns of a network (counters are synced first)
+	chan_columns(const network& nw);
+};
+
+
+/**
+	A columnar query interface over the channels of a network.
+
+	This provides the same fluent interface as \c chan_frame, but a
+	frame is represented as a selection bitmap over the dense channel
+	ids of a network. Predicates are evaluated over the \c channel_attrs
+	columns and tallies over the \c channel_counters columns, 64 channels
+	at a time, without touching the channel objects. This is the 
+	preferred way to compute statistics over very large networks.
+
+	A query is only valid as long as no channels are created or 
+	destroyed in the network.
+  */
+class chan_query
+{
+	chan_columns cols;
+	const network* nw;
+	vector<uint64_t> bits;
+
+	chan_query(const chan_query& q, vector<uint64_t>&& _bits)
+	: cols(q.cols), nw(q.nw), bits(std::move(_bits)) {}
+
+	// apply a predicate on a column
+	template <typename T>
+	chan_query filter(const T* chan_columns::* col, T value, T mask) const;
+	chan_query filter_addr(const host_addr* chan_columns::* col, 
+		const host_set& hs) const;
+	size_t column_sum(const size_t* chan_columns::* col) const;
+public:
+	/// All the channels of a network
+	chan_query(const network& _nw);
+	chan_query(const network* _nw) : chan_query(*_nw) {}
+
+	/**
+		All the live channels of a set of columns, e.g., from a 
+		snapshot. If \c _nw is null, there are no channel objects 
+		behind the columns, and \c frame() cannot be called.
+	  */
+	chan_query(const chan_columns& _cols, const network* _nw = nullptr);
+
+	/// The network of this query, or null
+	inline const network* net() const { return nw; }
+
+	/// The columns of this query
+	inline const chan_columns& columns() const { return cols; }
+
+	/// The protocol of the network
+	inline const rpc_protocol& rpc() const { return *cols.rpc; }
+
+	/// The selection bitmap, indexed by channel id
+	inline const vector<uint64_t>& bitmap() const { return bits; }
+
+	/// The number of selected channels
+	size_t size() const;
+
+	inline bool empty() const { return size()==0; }
+
+	/// Check if the channel of the given id is selected
+	inline bool contains(size_t cid) const {
+		return (cid>>6) < bits.size() && (bits[cid>>6]>>(cid&63)) & 1;
+	}
+
+	/// Return the selected channels as a frame
+	chan_frame frame() const;
+
+	//
+	// Statistics
+	//
+
+	// total messages over all channels
+	inline size_t msgs() const { return column_sum(&chan_columns::msgs); }
+
+	// total bytes over all channels
+	inline size_t bytes() const { return column_sum(&chan_columns::byts); }
+
+	// total received messages over broadcast channels
+	inline size_t recv_msgs() const { 
+		return column_sum(&chan_columns::rxmsgs); 
+	}
+
+	// total received bytes over broadcast channels
+	inline size_t recv_bytes() const { 
+		return column_sum(&chan_columns::rxbyts); 
+	}
+
+	// total messages in epochs [from, to), if windows are enabled
+	size_t msgs(size_t from, size_t to) const;
+
+	// total bytes in epochs [from, to), if windows are enabled
+	size_t bytes(size_t from, size_t to) const;
+
+	//
+	// Filter by source / destination
+	//
+
+	chan_query src(host_addr a) const { 
+		return filter(&chan_columns::src, a, ~host_addr(0)); 
+	}
+	chan_query src(host* h) const { return src(h->addr()); }
+	chan_query src_in(const host_set& hs) const { 
+		return filter_addr(&chan_columns::src, hs); 
+	}
+
+	chan_query dst(host_addr a) const { 
+		return filter(&chan_columns::dst, a, ~host_addr(0)); 
+	}
+	chan_query dst(host* h) const { return dst(h->addr()); }
+	chan_query dst_in(const host_set& hs) const { 
+		return filter_addr(&chan_columns::dst, hs); 
+	}
+
+	// Filter only unicast/multicast channels
+	chan_query unicast() const { 
+		return filter(&chan_columns::mcast, uint8_t(0), uint8_t(1)); 
+	}
+	chan_query multicast() const { 
+		return filter(&chan_columns::mcast, uint8_t(1), uint8_t(1)); 
+	}
+
+	// 
+	// filter by endpoint
+	//
+
+	chan_query endp(rpcc_t code, rpcc_t mask) const {
+		return filter(&chan_columns::rpcc, code & mask, mask);
+	}
+
+	// By interface (rpc_interface)
+	chan_query endp(const type_info& ti) const {
+		return endp(rpc().code(ti), RPCC_IFC_MASK);
+	}
+	chan_query endp(const string& ifname) const {
+		return endp(rpc().code(ifname), RPCC_IFC_MASK);
+	}
+
+	// By remote method (rpc_method)
+	chan_query endp(const type_info& ti, const string& mname) const {
+		return endp(rpc().code(ti, mname), RPCC_IFC_MASK|RPCC_METH_MASK);
+	}
+	chan_query endp(const string& ifname, const string& mname) const {
+		return endp(rpc().code(ifname, mname), RPCC_IFC_MASK|RPCC_METH_MASK);
+	}
+
+	// By endpoint direction
+	chan_query endp_req() const { return endp(0, RPCC_RESP_MASK); }
+	chan_query endp_rsp() const { return endp(1, RPCC_RESP_MASK); }
+
+	//
+	// Union, negation
+	//
+	chan_query union_with(const chan_query& other) const;
+	chan_query except(const chan_query& other) const;
+};
+
+
+/**
+	The most loaded hosts of a network, and the skew of load over all
+	hosts. This is computed by \c network::hotspots() from the host
+	totals (see \c channel_counters::by_host), in O(n log n) time for 
+	n hosts, without scanning the channels.
+  */
+struct hotspot_report
+{
+	struct entry
+	{
+		host* h;
+		host_addr addr;
+		traffic_totals traffic;
+		size_t load;
+	};
+
+	/// The most loaded hosts, most loaded first
+	vector<entry> top;
+
+	/// True if load is measured in bytes, else in messages
+	bool by_bytes = false;
+
+	/// The number of hosts and their total load
+	size_t hosts = 0;
+	size_t total = 0;
+
+	/// Statistics of the load over all hosts
+	size_t min = 0, median = 0, max = 0;
+	double mean = 0.0, stddev = 0.0;
+
+	/// The ratio of the maximum to the mean load (1 when balanced)
+	double imbalance = 0.0;
+
+	/// The Gini coefficient of the load (0 when balanced)
+	double gini = 0.0;
+
+	/// The fraction of the total load on the \c top hosts
+	double top_share = 0.0;
+
+	/// A printable table of the report
+	string repr() const;
+};
+
+
 } // end namespace dsarch
 
@@ -0,0 +1,439 @@
+/**
+	\file Asynchronous remote calls, based on C++20 coroutines.
+
+	Remote methods declared with \c REMOTE_ASYNC return an awaitable
+	\c call_task, instead of blocking the caller until the handler
+	returns. This allows a host to have many calls in flight, e.g.,
+	to pipeline a fan-out to many sites.
+
+	Asynchronous calls are driven by the \c simulator of the network:
+	the request is charged at send time, the handler runs when the
+	request is delivered, and the response is charged when the handler
+	completes; the awaiting coroutine is resumed when the response is
+	delivered.
+
+	If the simulator is destroyed while calls are in flight, the calls
+	fail: awaiting coroutines are resumed, during the destruction of
+	the simulator, with a \c std::runtime_error. Unless they catch it,
+	they complete with that error, so that detached tasks and call
+	states are freed.
+  */
+
+#pragma once
+
+#include <coroutine>
+#include <optional>
+
+#include "dsarch.hh"
+
+namespace dsarch {
+
+
+/**
+	A pool allocator for coroutine frames and call states.
+
+	Memory is handed out in size classes of 64 bytes, carved out of large
+	blocks and recycled through free lists, so that a large number of
+	outstanding calls does not stress the global allocator. Each thread
+	has its own pool; blocks are only released when the thread exits.
+	Larger requests go to the global allocator.
+  */
+class frame_pool
+{
+	static constexpr size_t granule = 64;
+	static constexpr size_t nclasses = 32;
+	static constexpr size_t block_size = 1<<16;
+
+	struct node { node* next; };
+	node* heads[nclasses] = {};
+	vector<std::unique_ptr<char[]>> blocks;
+
+	static inline size_t class_of(size_t n) { return (n + granule - 1)/granule - 1; }
+
+	void refill(size_t c) {
+		const size_t sz = (c+1)*granule;
+		blocks.emplace_back(new char[block_size]);
+		char* b = blocks.back().get();
+		for(size_t off = 0; off + sz <= block_size; off += sz) {
+			node* n = reinterpret_cast<node*>(b + off);
+			n->next = heads[c];
+			heads[c] = n;
+		}
+	}
+public:
+	/// The pool of the calling thread
+	static inline frame_pool& local() {
+		thread_local frame_pool pool;
+		return pool;
+	}
+
+	inline void* allocate(size_t n) {
+		size_t c = class_of(n);
+		if(c >= nclasses) return ::operator new(n);
+		if(heads[c] == nullptr) refill(c);
+		node* ret = heads[c];
+		heads[c] = ret->next;
+		return ret;
+	}
+
+	inline void deallocate(void* p, size_t n) {
+		size_t c = class_of(n);
+		if(c >= nclasses) { ::operator delete(p); return; }
+		node* nd = static_cast<node*>(p);
+		nd->next = heads[c];
+		heads[c] = nd;
+	}
+};
+
+
+/**
+	Mixin for types allocated from the frame pool.
+  */
+struct pool_allocated
+{
+	static void* operator new(size_t n) { return frame_pool::local().allocate(n); }
+	static void operator delete(void* p, size_t n) { frame_pool::local().deallocate(p, n); }
+};
+
+
+/*	----------------------------------------
+
+	Coroutine tasks
+
+	--------------------------------------- */
+
+
+template <typename T>
+class task;
+
+template <typename T>
+struct task_promise_base : pool_allocated
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+	bool detached = false;
+
+	inline std::suspend_never initial_suspend() noexcept { return {}; }
+
+	struct final_awaiter {
+		inline bool await_ready() noexcept { return false; }
+
+		template <typename Promise>
+		inline std::coroutine_handle<>
+		await_suspend(std::coroutine_handle<Promise> h) noexcept {
+			auto& p = h.promise();
+			if(p.detached) {
+				h.destroy();
+				return std::noop_coroutine();
+			}
+			if(p.continuation)
+				return p.continuation;
+			return std::noop_coroutine();
+		}
+
+		inline void await_resume() noexcept {}
+	};
+
+	inline final_awaiter final_suspend() noexcept { return {}; }
+
+	inline void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct task_promise : task_promise_base<T>
+{
+	std::optional<T> value;
+
+	task<T> get_return_object();
+
+	template <typename V>
+	inline void return_value(V&& v) { value.emplace(std::forward<V>(v)); }
+
+	inline T result() {
+		if(this->error) std::rethrow_exception(this->error);
+		return std::move(*value);
+	}
+};
+
+template <>
+struct task_promise<void> : task_promise_base<void>
+{
+	task<void> get_return_object();
+
+	inline void return_void() {}
+
+	inline void result() {
+		if(this->error) std::rethrow_exception(this->error);
+	}
+};
+
+
+/**
+	A coroutine task.
+
+	Hosts use tasks to write protocol logic that awaits asynchronous
+	remote calls. A task starts executing as soon as it is called, and
+	runs until its first suspension. Tasks can be awaited by other tasks.
+
+	If a task object is destroyed before the coroutine completes, the
+	coroutine is detached and destroys itself on completion (an
+	exception thrown by a detached task is lost).
+  */
+template <typename T = void>
+class task
+{
+public:
+	typedef task_promise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	task() {}
+	explicit task(handle_type _h) : h(_h) {}
+	task(task&& other) : h(other.h) { other.h = nullptr; }
+	task& operator=(task&& other) {
+		if(this != &other) { release(); h = other.h; other.h = nullptr; }
+		return *this;
+	}
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+	~task() { release(); }
+
+	/// True if the coroutine has completed
+	inline bool done() const { return !h || h.done(); }
+
+	/// The result of a completed task (rethrows an exception of the task)
+	inline T result() const { return h.promise().result(); }
+
+	inline bool await_ready() const noexcept { return h.done(); }
+	inline void await_suspend(std::coroutine_handle<> waiter) noexcept {
+		h.promise().continuation = waiter;
+	}
+	inline T await_resume() { return h.promise().result(); }
+
+private:
+	handle_type h = nullptr;
+
+	inline void release() {
+		if(! h) return;
+		if(h.done())
+			h.destroy();
+		else
+			h.promise().detached = true;
+		h = nullptr;
+	}
+};
+
+template <typename T>
+inline task<T> task_promise<T>::get_return_object() {
+	return task<T>(task<T>::handle_type::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+	return task<void>(task<void>::handle_type::from_promise(*this));
+}
+
+
+
+/*	----------------------------------------
+
+	Asynchronous remote calls
+
+	--------------------------------------- */
+
+
+/**
+	The shared state of an asynchronous call.
+
+	It is referenced by the pending delivery (see \c call_ref) and by
+	the \c call_task.
+  */
+template <typename Response>
+struct call_state : pool_allocated
+{
+	typedef typename std::conditional<std::is_void<Response>::value,
+		char, Response>::type value_type;
+
+	std::optional<value_type> value;
+	std::exception_ptr error;
+	std::coroutine_handle<> waiter;
+	bool done = false;
+	int refs = 2;
+
+	inline void release() { if(--refs == 0) delete this; }
+
+	/// Mark the call completed and resume the awaiting coroutine
+	inline void complete() {
+		done = true;
+		if(waiter) {
+			auto w = waiter;
+			waiter = nullptr;
+			w.resume();
+		}
+	}
+
+	/// Fail the call, unless it has completed
+	inline void abandon() {
+		if(done) return;
+		error = std::make_exception_ptr(
+			std::runtime_error("asynchronous call abandoned"));
+		complete();
+	}
+};
+
+
+/**
+	The reference of a pending delivery to the state of its call.
+
+	If the delivery is destroyed without completing the call, e.g.,
+	because the simulator is destroyed, the call is abandoned.
+  */
+template <typename Response>
+class call_ref
+{
+	call_state<Response>* st;
+public:
+	explicit call_ref(call_state<Response>* _st) : st(_st) {}
+	call_ref(call_ref&& other) : st(other.st) { other.st = nullptr; }
+	call_ref(const call_ref&) = delete;
+	call_ref& operator=(const call_ref&) = delete;
+	~call_ref() {
+		if(st) {
+			st->abandon();
+			st->release();
+		}
+	}
+
+	inline call_state<Response>* get() const { return st; }
+	inline call_state<Response>* operator->() const { return st; }
+	inline explicit operator bool() const { return st != nullptr; }
+};
+
+
+/**
+	The result of an asynchronous remote call.
+
+	This is an awaitable object. Awaiting it suspends the awaiting
+	coroutine until the response is delivered, and returns the
+	response. If the call is not awaited, its response is discarded.
+  */
+template <typename Response>
+class call_task
+{
+	call_state<Response>* st;
+public:
+	explicit call_task(call_state<Response>* _st) : st(_st) {}
+	call_task(call_task&& other) : st(other.st) { other.st = nullptr; }
+	call_task(const call_task&) = delete;
+	call_task& operator=(const call_task&) = delete;
+	~call_task() { if(st) st->release(); }
+
+	/// True if the response has been delivered
+	inline bool done() const { return st->done; }
+
+	inline bool await_ready() const noexcept { return st->done; }
+	inline void await_suspend(std::coroutine_handle<> h) noexcept { st->waiter = h; }
+	inline Response await_resume() {
+		if(st->error) std::rethrow_exception(st->error);
+		if constexpr (! std::is_void<Response>::value)
+			return std::move(*st->value);
+	}
+};
+
+
+/**
+	An asynchronous remote method.
+
+	This is the awaitable counterpart of \c remote_method. Calling it
+	charges the request on the request channel and schedules its
+	delivery in the network's simulator. The handler is executed upon
+	delivery; its response (unless it is a \c NAK) is charged on the
+	response channel and delivered back after the response channel's
+	latency. A \c NAK response, or a \c void method, completes the call
+	when the handler returns.
+
+	Only unicast proxies are supported. The proxy must outlive the
+	calls made through it.
+  */
+template <typename Dest, typename Response, typename ... Args>
+struct remote_async : proxy_method<Dest>
+{
+	typedef	Response (Dest::* method_type)(Args...);
+	typedef call_state<Response> state_type;
+
+	remote_async(remote_proxy<Dest>* _proxy, method_type _meth, const string& _name)
+	: proxy_method<Dest>(_proxy, std::is_void<Response>::value, _name, _meth)
+	{ }
+
+	/// The method of the destination
+	inline method_type method() const { 
+		return this->template method_as<method_type>(); 
+	}
+
+	call_task<Response> operator()(Args...args) const
+	{
+		simulator* sim = this->proxy()->_r_owner->net()->sim();
+		if(sim == nullptr)
+			throw std::logic_error("asynchronous remote calls require a simulator");
+		Dest* target = this->proxy()->proc();
+		if(target == nullptr)
+			throw std::logic_error("asynchronous remote calls must be unicast");
+
+		state_type* st = new state_type();
+		call_task<Response> ct(st);
+		size_t msize = this->wire_size(args...);
+		this->transmit_request(msize);
+		const remote_async* self = this;
+		sim->deliver(this->request_channel(), msize,
+			[=, ref = call_ref<Response>(st)]() mutable {
+				self->serve(sim, ref, target, args...);
+			});
+		return ct;
+	}
+
+private:
+	// execute the handler, at request delivery
+	void serve(simulator* sim, call_ref<Response>& ref, Dest* target,
+		const Args&... args) const
+	{
+		state_type* st = ref.get();
+		try {
+			handler_timer timer(*this);
+			if constexpr (std::is_void<Response>::value) {
+				(target->* method())(args...);
+			} else {
+				st->value.emplace((target->* method())(args...));
+				if( __transmit_response(*st->value) ) {
+					size_t rsize = this->wire_size(*st->value);
+					this->transmit_response(rsize);
+					sim->deliver(this->response_channel(), rsize,
+						[r = std::move(ref)]() { r->complete(); });
+					return;
+				}
+			}
+		} catch(...) {
+			// the response delivery was lost, and abandoned the call
+			if(! ref) throw;
+			st->error = std::current_exception();
+		}
+		st->complete();
+	}
+};
+
+
+template <typename T, typename Response, typename...Args>
+inline remote_async<T, Response, Args...>
+make_remote_async(
+	remote_proxy<T>* owner,
+	Response (T::*method)(Args...),
+	const string& _name
+	)
+{
+	return remote_async<T, Response, Args...>(owner, method, _name);
+}
+
+#define REMOTE_ASYNC(RClass, RMethod)\
+ decltype(dsarch::make_remote_async((remote_proxy<RClass>*)nullptr,\
+ 	&RClass::RMethod, #RMethod )) RMethod  \
+ { this, &RClass::RMethod, #RMethod }
+
+
+} // end namespace dsarch
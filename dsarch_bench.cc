@@ -0,0 +1,292 @@
+/**
+	\file Microbenchmarks of the dsarch hot paths.
+
+	Each benchmark is run at scales from 10^3 to 10^6 hosts or
+	channels (see \c bench::options), and reports the best rate of
+	several runs. Run with \c --help for the options, or via
+	\c make \c bench, which writes \c bench.json.
+  */
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <numeric>
+
+#include "dsarch_bench.hh"
+#include "dsarch_matrix.hh"
+
+using namespace dsarch;
+using namespace dsarch::bench;
+
+// defeats dead code elimination
+static volatile size_t sink;
+
+
+/*---- Fixture ----*/
+
+struct Node;
+struct Poke_proxy;
+struct Echo_proxy;
+
+struct Node : host
+{
+	size_t hits = 0;
+
+	Node(network* nw) : host(nw) {}
+
+	oneway poke(int x) { hits += x; }
+	int echo(int x) { return x+1; }
+};
+
+struct Poke_proxy : remote_proxy<Node>
+{
+	REMOTE_METHOD(Node, poke);
+	Poke_proxy(host* owner) : remote_proxy<Node>(owner) {}
+};
+
+struct Echo_proxy : remote_proxy<Node>
+{
+	REMOTE_METHOD(Node, echo);
+	Echo_proxy(host* owner) : remote_proxy<Node>(owner) {}
+};
+
+
+/**
+	A network of n nodes, plus a client node.
+  */
+struct world
+{
+	network nw;
+	vector<Node*> nodes;
+	Node* client;
+
+	world(size_t n) {
+		nodes.reserve(n);
+		for(size_t i = 0; i < n; i++)
+			nodes.push_back(new Node(&nw));
+		client = new Node(&nw);
+	}
+
+	~world() {
+		delete client;
+		for(auto h : nodes) delete h;
+	}
+};
+
+
+/**
+	Connect n channels among about sqrt(n) nodes, alternating
+	between two endpoints.
+  */
+static vector<channel*> connect_mesh(world& w, size_t n, rpcc_t m1, rpcc_t m2)
+{
+	size_t k = w.nodes.size();
+	vector<channel*> chans;
+	chans.reserve(n);
+	for(size_t a = 0; a < k && chans.size() < n; a++)
+		for(size_t b = 0; b < k && chans.size() < n; b++)
+			if(a != b)
+				chans.push_back(w.nw.connect(w.nodes[a], w.nodes[b],
+					(chans.size() & 1) ? m2 : m1));
+	return chans;
+}
+
+static size_t mesh_size(size_t n)
+{
+	return size_t(std::ceil(std::sqrt(double(n)))) + 1;
+}
+
+
+
+/*---- Benchmarks ----*/
+
+
+static void bench_calls(report& rep, const options& opts)
+{
+	for(size_t n : opts.scales()) {
+		// one-way calls, round-robin over n destinations
+		if(opts.selected("call.oneway")) {
+			world w(n);
+			proxy_map<Poke_proxy, Node> prx(w.client);
+			prx.add_sites(w.nodes);
+			vector<Poke_proxy*> p;
+			for(auto h : w.nodes) p.push_back(&prx[h]);
+			rep.run("call.oneway", n, "calls", [&]() {
+				return time_passes(opts.min_time, n, [&]() {
+					for(auto q : p) q->poke(1);
+				});
+			});
+		}
+
+		// two-way calls
+		if(opts.selected("call.twoway")) {
+			world w(n);
+			proxy_map<Echo_proxy, Node> prx(w.client);
+			prx.add_sites(w.nodes);
+			vector<Echo_proxy*> p;
+			for(auto h : w.nodes) p.push_back(&prx[h]);
+			rep.run("call.twoway", n, "calls", [&]() {
+				return time_passes(opts.min_time, n, [&]() {
+					size_t s = 0;
+					for(auto q : p) s += q->echo(1);
+					sink = s;
+				});
+			});
+		}
+	}
+}
+
+
+static void bench_multicast(report& rep, const options& opts)
+{
+	if(! opts.selected("multicast.fanout")) return;
+	for(size_t n : opts.scales()) {
+		world w(n);
+		mcast_group<Node> group(&w.nw);
+		for(auto h : w.nodes) group.join(h);
+		Poke_proxy p(w.client);
+		p <<= group;
+		rep.run("multicast.fanout", n, "deliveries", [&]() {
+			return time_passes(opts.min_time, n, [&]() { p.poke(1); });
+		});
+	}
+}
+
+
+static void bench_connect(report& rep, const options& opts)
+{
+	if(! opts.selected("network.connect")) return;
+	for(size_t n : opts.scales()) {
+		rep.run("network.connect", n, "channels", [&]() {
+			world w(mesh_size(n));
+			rpcc_t ifc = w.nw.decl_interface("Bench");
+			rpcc_t m1 = w.nw.decl_method(ifc, "m1", true);
+			rpcc_t m2 = w.nw.decl_method(ifc, "m2", true);
+			return time_once(n, [&]() { connect_mesh(w, n, m1, m2); });
+		});
+	}
+}
+
+
+static void bench_proxy_map(report& rep, const options& opts)
+{
+	for(size_t n : opts.scales()) {
+		if(! opts.selected("proxy_map")) continue;
+		world w(n);
+		w.nw.set_lazy_channels(true);
+
+		rep.run("proxy_map.add_sites", n, "proxies", [&]() {
+			proxy_map<Poke_proxy, Node> prx(w.client);
+			return time_once(n, [&]() { prx.add_sites(w.nodes); });
+		});
+
+		// lookups in random order
+		proxy_map<Poke_proxy, Node> prx(w.client);
+		prx.add_sites(w.nodes);
+		vector<Node*> order(w.nodes);
+		std::shuffle(order.begin(), order.end(), std::mt19937_64(n));
+		rep.run("proxy_map.lookup", n, "lookups", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				size_t s = 0;
+				for(auto h : order) s += size_t(&prx[h]);
+				sink = s;
+			});
+		});
+	}
+}
+
+
+static void bench_statistics(report& rep, const options& opts)
+{
+	if(! opts.selected("chan_") && ! opts.selected("traffic_matrix")) 
+		return;
+	for(size_t n : opts.scales()) {
+		world w(mesh_size(n));
+		rpcc_t ifc = w.nw.decl_interface("Bench");
+		rpcc_t m1 = w.nw.decl_method(ifc, "m1", true);
+		rpcc_t m2 = w.nw.decl_method(ifc, "m2", true);
+		vector<channel*> chans = connect_mesh(w, n, m1, m2);
+		for(size_t i = 0; i < chans.size(); i++)
+			chans[i]->transmit(i % 97);
+
+		const rpcc_t mask = RPCC_IFC_MASK|RPCC_METH_MASK;
+		chan_frame cf(w.nw);
+		rep.run("chan_frame.select", n, "channels", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = cf.endp(m1, mask).size();
+			});
+		});
+		rep.run("chan_frame.tally", n, "channels", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = cf.msgs() + cf.bytes();
+			});
+		});
+
+		chan_query q(w.nw);
+		rep.run("chan_query.select", n, "channels", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = q.endp(m1, mask).size();
+			});
+		});
+		rep.run("chan_query.tally", n, "channels", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = q.msgs() + q.bytes();
+			});
+		});
+
+		rep.run("traffic_matrix.build", n, "channels", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = traffic_matrix(w.nw).nnz();
+			});
+		});
+	}
+}
+
+
+static void bench_hotspots(report& rep, const options& opts)
+{
+	if(! opts.selected("network.hotspots")) return;
+	for(size_t n : opts.scales()) {
+		// the client calls every node, node i i%7 times
+		world w(n);
+		w.nw.set_lazy_channels(true);
+		proxy_map<Poke_proxy, Node> prx(w.client);
+		prx.add_sites(w.nodes);
+		for(size_t i = 0; i < n; i++)
+			for(size_t j = 0; j < i % 7; j++)
+				prx[w.nodes[i]].poke(1);
+
+		rep.run("network.hotspots", n, "hosts", [&]() {
+			return time_passes(opts.min_time, n, [&]() {
+				sink = w.nw.hotspots(10).total;
+			});
+		});
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	options opts;
+	try {
+		if(argc == 2 && strcmp(argv[1], "--help") == 0) {
+			printf("usage: %s [options]\n%s", argv[0], options::usage);
+			return 0;
+		}
+		opts.parse(argc, argv);
+	} catch(std::invalid_argument& e) {
+		fprintf(stderr, "%s: %s\nusage: %s [options]\n%s", argv[0], e.what(),
+			argv[0], options::usage);
+		return 2;
+	}
+
+	report rep(opts);
+	bench_calls(rep, opts);
+	bench_multicast(rep, opts);
+	bench_connect(rep, opts);
+	bench_proxy_map(rep, opts);
+	bench_statistics(rep, opts);
+	bench_hotspots(rep, opts);
+	rep.write_json();
+	return 0;
+}
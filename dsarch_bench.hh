@@ -0,0 +1,338 @@
+/**
+	\file Benchmark harness.
+
+	Utilities shared by the benchmark programs: command-line options,
+	timing of repeated passes, peak memory usage, and a report that
+	prints results as they are produced and writes them to a JSON file.
+
+	The JSON file has the form
+	```
+	{ "label": ..., "compiler": ..., "peak_rss_kb": ...,
+	  "results": [ { "name": ..., "scale": ..., "unit": ..., "ops": ...,
+	      "seconds": ..., "rate": ..., "runs": [...], "metrics": {...} }, ... ] }
+	```
+	where \c rate is the best of all runs, in units per second.
+	Results of different versions of the library can be compared
+	by name and scale.
+  */
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+
+#include <sys/resource.h>
+
+#include "dsarch.hh"
+
+namespace dsarch {
+namespace bench {
+
+using std::string;
+using std::vector;
+
+
+/**
+	Options common to all benchmark programs.
+  */
+struct options
+{
+	/// JSON output file, if not empty
+	string json;
+	/// A label for the run, e.g., the library version
+	string label;
+	/// Only run benchmarks whose name contains this string
+	string filter;
+	/// The range of scales (hosts or channels)
+	size_t min_scale = 1000;
+	size_t max_scale = 1000000;
+	/// The number of runs of each benchmark
+	unsigned repeat = 3;
+	/// The minimum duration of a run, in seconds
+	double min_time = 0.2;
+
+	/**
+		A handler of program-specific options. It returns false if
+		it does not recognize an option.
+	  */
+	typedef std::function<bool(const string& opt, const string& val)> handler;
+
+	/**
+		Parse the command line. Options not recognized here are
+		passed to \c extra, if given. Throws \c std::invalid_argument
+		on unknown or malformed options.
+	  */
+	void parse(int argc, char** argv, const handler& extra = nullptr);
+
+	/// The usage message
+	static const char* usage;
+
+	/// Check if a benchmark is selected by the filter
+	inline bool selected(const string& name) const {
+		return name.find(filter) != string::npos;
+	}
+
+	/// The powers of 10 in the range of scales
+	vector<size_t> scales() const;
+};
+
+
+inline const char* options::usage =
+	"options:\n"
+	"  --json FILE       write the results to FILE\n"
+	"  --label LABEL     label the results, e.g., with a version\n"
+	"  --filter STR      run only benchmarks whose name contains STR\n"
+	"  --min-scale N     the smallest scale (default 1000)\n"
+	"  --max-scale N     the largest scale (default 1000000)\n"
+	"  --repeat N        runs of each benchmark (default 3)\n"
+	"  --min-time SEC    minimum duration of a run (default 0.2)\n";
+
+
+inline void options::parse(int argc, char** argv, const handler& extra)
+{
+	for(int i = 1; i < argc; i++) {
+		string opt = argv[i];
+		if(i+1 == argc)
+			throw std::invalid_argument("missing value for " + opt);
+		string val = argv[++i];
+		try {
+			if(opt == "--json") json = val;
+			else if(opt == "--label") label = val;
+			else if(opt == "--filter") filter = val;
+			else if(opt == "--min-scale") min_scale = std::stoul(val);
+			else if(opt == "--max-scale") max_scale = std::stoul(val);
+			else if(opt == "--repeat") repeat = std::stoul(val);
+			else if(opt == "--min-time") min_time = std::stod(val);
+			else if(extra && extra(opt, val)) continue;
+			else
+				throw std::invalid_argument("unknown option " + opt);
+		} catch(std::logic_error&) {
+			throw std::invalid_argument("bad value for " + opt + ": " + val);
+		}
+	}
+	if(repeat == 0 || min_scale == 0 || min_scale > max_scale)
+		throw std::invalid_argument("bad repeat count or scale range");
+}
+
+
+inline vector<size_t> options::scales() const
+{
+	vector<size_t> ret;
+	for(size_t s = 1; s <= max_scale; s *= 10)
+		if(s >= min_scale) ret.push_back(s);
+	return ret;
+}
+
+
+/**
+	Wall-clock time since construction, in seconds.
+  */
+class stopwatch
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+public:
+	inline double elapsed() const {
+		return std::chrono::duration<double>(clock::now() - start).count();
+	}
+	inline void restart() { start = clock::now(); }
+};
+
+
+/**
+	The peak resident set size of the process, in kilobytes.
+  */
+inline size_t peak_rss_kb()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+
+/**
+	The outcome of one run of a benchmark.
+  */
+struct measurement
+{
+	size_t ops = 0;
+	double seconds = 0.0;
+
+	inline double rate() const { return seconds > 0 ? ops/seconds : 0.0; }
+};
+
+
+/**
+	Time a single pass of a function, which performs \c ops operations.
+  */
+template <typename Func>
+inline measurement time_once(size_t ops, Func&& pass)
+{
+	stopwatch sw;
+	pass();
+	return measurement { ops, sw.elapsed() };
+}
+
+
+/**
+	Time repeated passes of a function, each performing \c ops
+	operations, until at least \c min_time seconds have elapsed.
+  */
+template <typename Func>
+inline measurement time_passes(double min_time, size_t ops, Func&& pass)
+{
+	measurement m;
+	stopwatch sw;
+	do {
+		pass();
+		m.ops += ops;
+		m.seconds = sw.elapsed();
+	} while(m.seconds < min_time);
+	return m;
+}
+
+
+/**
+	The results of a benchmark program.
+  */
+class report
+{
+public:
+	typedef vector<std::pair<string, double>> metrics;
+
+	report(const options& _opts) : opts(_opts) {}
+
+	/**
+		Add the runs of a benchmark at some scale, and print the
+		best run. \c unit describes the operations, e.g., "calls".
+	  */
+	void add(const string& name, size_t scale, const string& unit,
+		const vector<measurement>& runs, const metrics& extra = metrics());
+
+	/**
+		Add a benchmark whose runs produce extra metrics. The metrics
+		of the best run are reported.
+	  */
+	void add(const string& name, size_t scale, const string& unit,
+		const vector<std::pair<measurement, metrics>>& runs);
+
+	/// Write the results to the JSON file, if one was given
+	void write_json() const;
+
+	/// Run a benchmark \c opts.repeat times and add its runs
+	template <typename Func>
+	void run(const string& name, size_t scale, const string& unit, Func&& func) {
+		if(! opts.selected(name)) return;
+		vector<measurement> runs;
+		for(unsigned r = 0; r < opts.repeat; r++)
+			runs.push_back(func());
+		add(name, scale, unit, runs);
+	}
+
+private:
+	struct entry
+	{
+		string name;
+		size_t scale;
+		string unit;
+		vector<measurement> runs;
+		metrics extra;
+		measurement best;
+	};
+
+	const options& opts;
+	vector<entry> entries;
+};
+
+
+// JSON string literal
+inline string json_string(const string& s)
+{
+	string ret = "\"";
+	for(char c : s) {
+		if(c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if((unsigned char)c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		} else
+			ret += c;
+	}
+	return ret + "\"";
+}
+
+
+inline void report::add(const string& name, size_t scale, const string& unit,
+	const vector<measurement>& runs, const metrics& extra)
+{
+	if(runs.empty())
+		throw std::invalid_argument("no runs for benchmark " + name);
+	entry e { name, scale, unit, runs, extra, runs[0] };
+	for(auto& m : runs)
+		if(m.rate() > e.best.rate()) e.best = m;
+	entries.push_back(e);
+
+	printf("%-28s %9zu %14.0f %s/s  %10.6f s", name.c_str(), scale,
+		e.best.rate(), unit.c_str(), e.best.seconds);
+	for(auto& [key, value] : extra)
+		printf("  %s=%g", key.c_str(), value);
+	printf("\n");
+	fflush(stdout);
+}
+
+
+inline void report::add(const string& name, size_t scale, const string& unit,
+	const vector<std::pair<measurement, metrics>>& runs)
+{
+	vector<measurement> m;
+	size_t best = 0;
+	for(size_t i = 0; i < runs.size(); i++) {
+		m.push_back(runs[i].first);
+		if(m[i].rate() > m[best].rate()) best = i;
+	}
+	add(name, scale, unit, m, runs.empty() ? metrics() : runs[best].second);
+}
+
+
+inline void report::write_json() const
+{
+	if(opts.json.empty()) return;
+	std::FILE* f = fopen(opts.json.c_str(), "w");
+	if(f == nullptr)
+		throw std::runtime_error("cannot open " + opts.json);
+
+	fprintf(f, "{\n  \"label\": %s,\n", json_string(opts.label).c_str());
+	fprintf(f, "  \"compiler\": %s,\n", json_string(__VERSION__).c_str());
+	fprintf(f, "  \"peak_rss_kb\": %zu,\n", peak_rss_kb());
+	fprintf(f, "  \"results\": [");
+	for(size_t i = 0; i < entries.size(); i++) {
+		const entry& e = entries[i];
+		fprintf(f, "%s\n    { \"name\": %s, \"scale\": %zu, \"unit\": %s, "
+			"\"ops\": %zu, \"seconds\": %.9g, \"rate\": %.9g,\n      \"runs\": [",
+			i ? "," : "", json_string(e.name).c_str(), e.scale,
+			json_string(e.unit).c_str(), e.best.ops, e.best.seconds,
+			e.best.rate());
+		for(size_t j = 0; j < e.runs.size(); j++)
+			fprintf(f, "%s{ \"ops\": %zu, \"seconds\": %.9g }", j ? ", " : "",
+				e.runs[j].ops, e.runs[j].seconds);
+		fprintf(f, "],\n      \"metrics\": {");
+		for(size_t j = 0; j < e.extra.size(); j++)
+			fprintf(f, "%s %s: %.9g", j ? "," : "",
+				json_string(e.extra[j].first).c_str(), e.extra[j].second);
+		fprintf(f, " } }");
+	}
+	fprintf(f, "\n  ]\n}\n");
+	if(fclose(f) != 0)
+		throw std::runtime_error("error writing " + opts.json);
+}
+
+
+} // end namespace bench
+} // end namespace dsarch
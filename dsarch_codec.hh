@@ -0,0 +1,191 @@
+/**
+	\file Wire codecs for message sizing.
+
+	The \c byte_size functions give a rough estimate of the size of a
+	message. A wire codec instead gives the exact size of a message
+	under a particular encoding, e.g., with variable-length integers
+	and length-prefixed strings. Sizes are computed arithmetically,
+	without allocating or serializing the message.
+
+	A codec is a policy class, with the following static members:
+	- \c integer(v): the encoded size of an integer value
+	- \c length(n): the size of the length prefix of a sequence of n elements
+	- \c presence: the size of the flag of an optional value
+
+	Floating point values are encoded at their native size, and
+	booleans take one byte, under all codecs. Fixed-length arrays, pairs
+	and tuples have no prefix. A class type can define its encoding
+	by a member template
+	```
+	template <typename Codec> size_t encoded_size() const;
+	```
+	otherwise it is sized by \c byte_size().
+  */
+
+#pragma once
+
+#include <cstdint>
+
+#include "dsarch_types.hh"
+
+namespace dsarch {
+
+
+/**
+	Fixed-width integers, 32-bit length prefixes.
+  */
+struct fixed_codec
+{
+	template <typename Int>
+	static constexpr size_t integer(Int) { return sizeof(Int); }
+	static constexpr size_t length(size_t) { return 4; }
+	static constexpr size_t presence = 1;
+};
+
+
+/**
+	Variable-length integers and length prefixes.
+
+	Integers are encoded in LEB128, 7 bits per byte. Signed integers
+	are first zigzag-mapped, so that small negative values take few
+	bytes. This is the encoding of protocol buffers.
+  */
+struct varint_codec
+{
+	/// The size of an unsigned LEB128 value
+	static constexpr size_t varint(uint64_t v) {
+		return v == 0 ? 1 : (70 - __builtin_clzll(v)) / 7;
+	}
+
+	/// The zigzag mapping of a signed value
+	static constexpr uint64_t zigzag(int64_t v) {
+		return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+	}
+
+	template <typename Int>
+	static constexpr size_t integer(Int v) {
+		if constexpr (std::is_signed_v<Int>)
+			return varint(zigzag(v));
+		else
+			return varint(v);
+	}
+	static constexpr size_t length(size_t n) { return varint(n); }
+	static constexpr size_t presence = 1;
+};
+
+
+/**
+	The codecs that a network can be set to use.
+  */
+enum class wire_codec : uint8_t
+{
+	/// The \c byte_size() estimates
+	estimate = 0,
+	/// \c fixed_codec
+	fixed = 1,
+	/// \c varint_codec
+	varint = 2
+};
+
+
+template <typename Codec, typename T>
+size_t encoded_size(const T& x);
+template <typename Codec>
+size_t encoded_size(const std::string& s);
+template <typename Codec, typename T, typename Alloc>
+size_t encoded_size(const std::vector<T, Alloc>& v);
+template <typename Codec, typename T, size_t N>
+size_t encoded_size(const std::array<T, N>& a);
+template <typename Codec, typename A, typename B>
+size_t encoded_size(const std::pair<A, B>& p);
+template <typename Codec, typename...Ts>
+size_t encoded_size(const std::tuple<Ts...>& t);
+template <typename Codec, typename T>
+size_t encoded_size(const std::optional<T>& o);
+
+
+/**
+	The encoded size of a value under a codec.
+  */
+template <typename Codec, typename T>
+inline size_t encoded_size(const T& x)
+{
+	if constexpr (std::is_same_v<T, bool>)
+		return 1;
+	else if constexpr (std::is_integral_v<T>)
+		return Codec::integer(x);
+	else if constexpr (std::is_enum_v<T>)
+		return Codec::integer(std::underlying_type_t<T>(x));
+	else if constexpr (std::is_floating_point_v<T>)
+		return sizeof(T);
+	else if constexpr (requires { x.template encoded_size<Codec>(); })
+		return x.template encoded_size<Codec>();
+	else
+		return byte_size(x);
+}
+
+template <typename Codec>
+inline size_t encoded_size(const std::string& s)
+{
+	return Codec::length(s.size()) + s.size();
+}
+
+// the elements of a sequence, without prefix
+template <typename Codec, typename Seq>
+inline size_t __encoded_elements(const Seq& seq)
+{
+	typedef typename Seq::value_type T;
+	if constexpr (std::is_floating_point_v<T> ||
+		(std::is_integral_v<T> && std::is_same_v<Codec, fixed_codec>))
+		return seq.size() * (std::is_same_v<T, bool> ? 1 : sizeof(T));
+	else {
+		size_t total = 0;
+		for(const T& x : seq) total += encoded_size<Codec>(x);
+		return total;
+	}
+}
+
+template <typename Codec, typename T, typename Alloc>
+inline size_t encoded_size(const std::vector<T, Alloc>& v)
+{
+	return Codec::length(v.size()) + __encoded_elements<Codec>(v);
+}
+
+template <typename Codec, typename T, size_t N>
+inline size_t encoded_size(const std::array<T, N>& a)
+{
+	return __encoded_elements<Codec>(a);
+}
+
+template <typename Codec, typename A, typename B>
+inline size_t encoded_size(const std::pair<A, B>& p)
+{
+	return encoded_size<Codec>(p.first) + encoded_size<Codec>(p.second);
+}
+
+template <typename Codec, typename...Ts>
+inline size_t encoded_size(const std::tuple<Ts...>& t)
+{
+	return std::apply([](const Ts&...x) {
+		return (size_t(0) + ... + encoded_size<Codec>(x));
+	}, t);
+}
+
+template <typename Codec, typename T>
+inline size_t encoded_size(const std::optional<T>& o)
+{
+	return Codec::presence + (o ? encoded_size<Codec>(*o) : 0);
+}
+
+
+/**
+	The encoded size of an argument list under a codec.
+  */
+template <typename Codec, typename...Args>
+inline size_t encoded_message_size(const Args&...args)
+{
+	return (size_t(0) + ... + encoded_size<Codec>(args));
+}
+
+
+} // end namespace dsarch
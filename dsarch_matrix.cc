@@ -0,0 +1,378 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+
+#include "dsarch_matrix.hh"
+
+namespace dsarch {
+
+using namespace std;
+
+static_assert(sizeof(size_t) == sizeof(uint64_t),
+	"traffic matrices require 64-bit counters");
+
+static const char matrix_magic[4] = { 'D', 'S', 'T', 'M' };
+static const uint32_t matrix_version = 2;
+
+namespace {
+
+struct matrix_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t rows;
+	uint64_t nnz;
+	uint64_t code, mask;
+	uint64_t reserved;
+};
+
+static_assert(sizeof(matrix_header) == 48, "unexpected header layout");
+
+inline size_t align8(size_t n) { return (n+7) & ~size_t(7); }
+
+// run f(t) for t in [0,n), on n threads
+template <typename Func>
+void parallel(unsigned n, Func&& f)
+{
+	if(n == 1) { f(0u); return; }
+	vector<std::thread> threads;
+	threads.reserve(n-1);
+	for(unsigned t = 1; t < n; t++)
+		threads.emplace_back([&f,t]() { f(t); });
+	f(0u);
+	for(auto& th : threads) th.join();
+}
+
+// the t-th of n equal parts of [0,len), aligned to multiples of 64
+inline std::pair<size_t,size_t> part(size_t len, unsigned t, unsigned n)
+{
+	size_t words = (len+63)/64;
+	return { std::min(len, (words*t/n)*64), std::min(len, (words*(t+1)/n)*64) };
+}
+
+// below this many channels, build on a single thread by default
+const size_t min_parallel_slots = 1<<16;
+
+// rows are looked up in a table when the sources span at most this
+// many addresses per channel, else by binary search
+const size_t dense_rows_factor = 4;
+
+}  // end anonymous namespace
+
+
+
+//-------------------
+//
+//  matrix construction
+//
+//-------------------
+
+
+traffic_matrix::traffic_matrix(const network& nw, rpcc_t _code,
+	rpcc_t _mask, unsigned nthreads)
+: traffic_matrix(chan_columns(nw), _code, _mask, nthreads)
+{ }
+
+
+traffic_matrix::traffic_matrix(const network& nw, const string& ifname,
+	unsigned nthreads)
+: traffic_matrix()
+{
+	// code 0 would select the channels without an interface
+	rpcc_t ifc = nw.rpc().code(ifname);
+	if(ifc != 0)
+		*this = traffic_matrix(chan_columns(nw), ifc, RPCC_IFC_MASK, nthreads);
+}
+
+
+/*
+	The matrix is built in parallel phases. Each thread selects the 
+	channels of its part of the columns, and collects their sources,
+	which are merged into the row addresses. Then, each thread counts
+	its channels by row and, after a prefix sum, scatters them into 
+	their rows. Then, each
+	thread sorts a part of the rows by destination and counts the 
+	distinct destinations; after another prefix sum, it merges the 
+	channels of its rows into the final entries.
+  */
+traffic_matrix::traffic_matrix(const chan_columns& cols, rpcc_t _code,
+	rpcc_t _mask, unsigned nthreads)
+: code(_code & _mask), mask(_mask)
+{
+	const size_t nslots = std::min(cols.slots, cols.counters);
+	if(nthreads == 0)
+		nthreads = (nslots < min_parallel_slots) ? 1 :
+			std::max(1u, std::thread::hardware_concurrency());
+
+	// select the channels of each part, and the range of their sources
+	vector<vector<uint32_t>> sel(nthreads);
+	vector<host_addr> lo(nthreads, std::numeric_limits<host_addr>::max());
+	vector<host_addr> hi(nthreads, std::numeric_limits<host_addr>::min());
+	parallel(nthreads, [&](unsigned t) {
+		auto [from, to] = part(nslots, t, nthreads);
+		vector<uint32_t>& s = sel[t];
+		for(size_t cid = from; cid < to; cid++) {
+			if(! (cols.live[cid>>6] & (uint64_t(1) << (cid&63)))) continue;
+			if(cols.mcast[cid] || cols.msgs[cid] == 0) continue;
+			if((cols.rpcc[cid] & mask) != code) continue;
+			s.push_back(cid);
+			lo[t] = std::min(lo[t], cols.src[cid]);
+			hi[t] = std::max(hi[t], cols.src[cid]);
+		}
+	});
+	size_t nsel = 0;
+	for(auto& s : sel) nsel += s.size();
+
+	// the row of each channel
+	vector<vector<uint32_t>> crow(nthreads);
+	for(unsigned t = 0; t < nthreads; t++) crow[t].resize(sel[t].size());
+	const host_addr amin = *std::min_element(lo.begin(), lo.end());
+	const host_addr amax = *std::max_element(hi.begin(), hi.end());
+	const size_t range = (nsel == 0) ? 0 : size_t(int64_t(amax) - amin) + 1;
+	if(range <= dense_rows_factor*nsel) {
+		// compact sources: mark them in a table over their range
+		vector<uint32_t> rowid(range, 0);
+		parallel(nthreads, [&](unsigned t) {
+			for(uint32_t cid : sel[t])
+				std::atomic_ref<uint32_t>(rowid[cols.src[cid]-amin])
+					.store(1, std::memory_order_relaxed);
+		});
+		for(size_t i = 0; i < range; i++)
+			if(rowid[i]) {
+				rowid[i] = row_addr.size();
+				row_addr.push_back(host_addr(amin + int64_t(i)));
+			}
+		parallel(nthreads, [&](unsigned t) {
+			for(size_t i = 0; i < sel[t].size(); i++)
+				crow[t][i] = rowid[cols.src[sel[t][i]]-amin];
+		});
+	} else {
+		// sparse sources: sort them, and search for each channel
+		vector<vector<host_addr>> srcs(nthreads);
+		parallel(nthreads, [&](unsigned t) {
+			vector<host_addr>& a = srcs[t];
+			for(uint32_t cid : sel[t]) a.push_back(cols.src[cid]);
+			std::sort(a.begin(), a.end());
+			a.erase(std::unique(a.begin(), a.end()), a.end());
+		});
+		for(auto& a : srcs)
+			row_addr.insert(row_addr.end(), a.begin(), a.end());
+		srcs.clear();
+		std::sort(row_addr.begin(), row_addr.end());
+		row_addr.erase(std::unique(row_addr.begin(), row_addr.end()), 
+			row_addr.end());
+		parallel(nthreads, [&](unsigned t) {
+			for(size_t i = 0; i < sel[t].size(); i++)
+				crow[t][i] = std::lower_bound(row_addr.begin(), row_addr.end(),
+					cols.src[sel[t][i]]) - row_addr.begin();
+		});
+	}
+	const size_t nrows = row_addr.size();
+
+	// count and scatter the channels into rows
+	vector<uint64_t> start(nrows+1, 0);
+	parallel(nthreads, [&](unsigned t) {
+		for(uint32_t r : crow[t])
+			std::atomic_ref<uint64_t>(start[r+1])
+				.fetch_add(1, std::memory_order_relaxed);
+	});
+	for(size_t r = 0; r < nrows; r++) start[r+1] += start[r];
+
+	const size_t nchan = start[nrows];
+	vector<uint64_t> cursor(start.begin(), start.end()-1);
+	vector<uint32_t> chan(nchan);
+	parallel(nthreads, [&](unsigned t) {
+		for(size_t i = 0; i < sel[t].size(); i++) {
+			uint64_t pos = std::atomic_ref<uint64_t>(cursor[crow[t][i]])
+				.fetch_add(1, std::memory_order_relaxed);
+			chan[pos] = sel[t][i];
+		}
+	});
+	sel.clear();
+	crow.clear();
+	cursor.clear();
+
+	// sort the rows and merge channels with the same destination
+	vector<uint64_t> len(nrows+1, 0);
+	parallel(nthreads, [&](unsigned t) {
+		auto [from, to] = part(nrows, t, nthreads);
+		for(size_t r = from; r < to; r++) {
+			uint32_t* b = chan.data() + start[r];
+			uint32_t* e = chan.data() + start[r+1];
+			if(e-b > 1)
+				std::sort(b, e, [&](uint32_t x, uint32_t y) {
+					return cols.dst[x] < cols.dst[y];
+				});
+			size_t n = 0;
+			for(uint32_t* p = b; p != e; p++)
+				if(p == b || cols.dst[*p] != cols.dst[p[-1]]) n++;
+			len[r+1] = n;
+		}
+	});
+
+	row_ptr.assign(nrows+1, 0);
+	for(size_t r = 0; r < nrows; r++) row_ptr[r+1] = row_ptr[r] + len[r+1];
+	const size_t n = row_ptr[nrows];
+	col.resize(n);
+	msgs.resize(n);
+	byts.resize(n);
+	parallel(nthreads, [&](unsigned t) {
+		auto [from, to] = part(nrows, t, nthreads);
+		for(size_t r = from; r < to; r++) {
+			size_t k = row_ptr[r];
+			for(size_t i = start[r]; i < start[r+1]; i++) {
+				uint32_t cid = chan[i];
+				if(i > start[r] && cols.dst[cid] == col[k-1]) {
+					msgs[k-1] += cols.msgs[cid];
+					byts[k-1] += cols.byts[cid];
+				} else {
+					col[k] = cols.dst[cid];
+					msgs[k] = cols.msgs[cid];
+					byts[k] = cols.byts[cid];
+					k++;
+				}
+			}
+		}
+	});
+}
+
+
+size_t traffic_matrix::row(host_addr src) const
+{
+	auto it = std::lower_bound(row_addr.begin(), row_addr.end(), src);
+	return (it != row_addr.end() && *it == src) ? it - row_addr.begin() : rows();
+}
+
+
+size_t traffic_matrix::find(host_addr src, host_addr dst) const
+{
+	size_t r = row(src);
+	if(r == rows()) return nnz();
+	auto b = col.begin() + row_ptr[r];
+	auto e = col.begin() + row_ptr[r+1];
+	auto it = std::lower_bound(b, e, dst);
+	return (it != e && *it == dst) ? it - col.begin() : nnz();
+}
+
+
+size_t traffic_matrix::total_msgs() const
+{
+	return channel_counters::sum(msgs);
+}
+
+
+size_t traffic_matrix::total_bytes() const
+{
+	return channel_counters::sum(byts);
+}
+
+
+
+//-------------------
+//
+//  matrix files
+//
+//-------------------
+
+
+void traffic_matrix::write(const string& path) const
+{
+	matrix_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, matrix_magic, 4);
+	hdr.version = matrix_version;
+	hdr.rows = rows();
+	hdr.nnz = nnz();
+	hdr.code = code;
+	hdr.mask = mask;
+
+	std::FILE* f = fopen(path.c_str(), "wb");
+	if(f == nullptr)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open matrix file " + path);
+
+	size_t pos = 0;
+	bool ok = true;
+	auto put = [&](const void* data, size_t len) {
+		if(len > 0)
+			ok = ok && fwrite(data, 1, len, f) == len;
+		pos += len;
+	};
+	auto pad = [&]() {
+		static const char zeros[8] = { 0 };
+		put(zeros, align8(pos) - pos);
+	};
+
+	put(&hdr, sizeof(hdr));
+	put(row_addr.data(), row_addr.size()*sizeof(host_addr));
+	pad();
+	put(row_ptr.data(), row_ptr.size()*sizeof(uint64_t));
+	put(col.data(), col.size()*sizeof(host_addr));
+	pad();
+	put(msgs.data(), msgs.size()*sizeof(uint64_t));
+	put(byts.data(), byts.size()*sizeof(uint64_t));
+
+	if(fclose(f) != 0 || ! ok)
+		throw std::runtime_error("error writing matrix file " + path);
+}
+
+
+traffic_matrix traffic_matrix::read(const string& path)
+{
+	std::FILE* f = fopen(path.c_str(), "rb");
+	if(f == nullptr)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open matrix file " + path);
+
+	size_t pos = 0;
+	bool ok = true;
+	auto get = [&](void* data, size_t len) {
+		if(len > 0)
+			ok = ok && fread(data, 1, len, f) == len;
+		pos += len;
+	};
+	auto skip = [&]() {
+		char zeros[8];
+		get(zeros, align8(pos) - pos);
+	};
+
+	traffic_matrix m;
+	matrix_header hdr;
+	get(&hdr, sizeof(hdr));
+	if(! ok || memcmp(hdr.magic, matrix_magic, 4) != 0
+			|| hdr.version != matrix_version) {
+		fclose(f);
+		throw std::runtime_error("not a matrix file: " + path);
+	}
+	m.code = hdr.code;
+	m.mask = hdr.mask;
+	try {
+		m.row_addr.resize(hdr.rows);
+		m.row_ptr.resize(hdr.rows+1);
+		m.col.resize(hdr.nnz);
+		m.msgs.resize(hdr.nnz);
+		m.byts.resize(hdr.nnz);
+	} catch(std::exception&) {
+		fclose(f);
+		throw std::runtime_error("corrupt matrix file " + path);
+	}
+	get(m.row_addr.data(), m.row_addr.size()*sizeof(host_addr));
+	skip();
+	get(m.row_ptr.data(), m.row_ptr.size()*sizeof(uint64_t));
+	get(m.col.data(), m.col.size()*sizeof(host_addr));
+	skip();
+	get(m.msgs.data(), m.msgs.size()*sizeof(uint64_t));
+	get(m.byts.data(), m.byts.size()*sizeof(uint64_t));
+	fclose(f);
+
+	if(! ok || m.row_ptr.front() != 0 || m.row_ptr.back() != hdr.nnz
+			|| ! std::is_sorted(m.row_ptr.begin(), m.row_ptr.end())
+			|| std::adjacent_find(m.row_addr.begin(), m.row_addr.end(),
+				std::greater_equal<host_addr>()) != m.row_addr.end())
+		throw std::runtime_error("corrupt matrix file " + path);
+	return m;
+}
+
+
+} // end namespace dsarch
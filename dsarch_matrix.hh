@@ -0,0 +1,116 @@
+/**
+	\file Host-by-host traffic matrices.
+
+	A traffic matrix holds the traffic of every pair of hosts that
+	communicate, in compressed sparse row (CSR) form: there is one row
+	for each host that sends traffic, in increasing address order, and
+	the entries of a row are the destinations of its traffic, in 
+	increasing address order, each with the number of messages and 
+	bytes sent. Only unicast channels are included, since the receivers 
+	of a multicast are not recorded per channel.
+
+	A matrix is built from the channel columns (see \c chan_columns)
+	of a network or a snapshot, in parallel, without touching the
+	channel objects.
+
+	The binary format of a matrix file is a 48-byte header, followed
+	by the row addresses (32-bit, padded to 8 bytes), the row offsets 
+	(64-bit), the destination addresses (32-bit, padded to 8 bytes), 
+	the message counts and the byte counts (64-bit). The header consists of the magic string "DSTM", a 32-bit
+	version, and five 64-bit fields: the number of rows, the number of 
+	entries, the rpc code and mask of the slice, and a reserved zero. 
+	All numbers are in the byte order of the machine that wrote the file.
+  */
+
+#pragma once
+
+#include "dsarch.hh"
+
+namespace dsarch {
+
+
+/**
+	A sparse host-by-host traffic matrix, in CSR form.
+
+	Only the hosts that send traffic have a row, so the size of the
+	matrix depends on the traffic, not on how sparse the addresses are.
+	Rows are looked up by address with a binary search. Multiple 
+	channels between the same pair of hosts (e.g., for different rpc 
+	endpoints) are summed into one entry. Channels that have not 
+	transmitted are omitted.
+
+	A matrix may be restricted to a slice of the traffic, by rpc code,
+	as with \c chan_query::endp(): a channel is included if its rpc
+	code agrees with \c code on the bits of \c mask.
+  */
+class traffic_matrix
+{
+public:
+	/// The source address of each row, in increasing order
+	vector<host_addr> row_addr;
+	/// Row offsets, \c rows()+1 entries
+	vector<uint64_t> row_ptr;
+	/// The destination address of each entry
+	vector<host_addr> col;
+	/// The messages and bytes of each entry
+	vector<uint64_t> msgs, byts;
+
+	/// The slice of the matrix
+	rpcc_t code = 0, mask = 0;
+
+	/// An empty matrix
+	traffic_matrix() : row_ptr(1, 0) { }
+
+	/**
+		Build the matrix of a network, using \c nthreads threads.
+		By default, small networks are done on one thread and large
+		ones on every hardware thread. If counters are sharded, they 
+		are merged first.
+	  */
+	traffic_matrix(const network& nw, rpcc_t code = 0, rpcc_t mask = 0,
+		unsigned nthreads = 0);
+
+	/// Build the matrix of one interface of a network, or an empty
+	/// matrix if the interface is unknown
+	traffic_matrix(const network& nw, const string& ifname,
+		unsigned nthreads = 0);
+
+	/// Build the matrix of a set of channel columns, e.g., of a snapshot
+	traffic_matrix(const chan_columns& cols, rpcc_t code = 0,
+		rpcc_t mask = 0, unsigned nthreads = 0);
+
+	/// Read a matrix from a file written by \c write()
+	static traffic_matrix read(const string& path);
+
+	/// Write the matrix to a file
+	void write(const string& path) const;
+
+	/// The number of non-empty rows
+	inline size_t rows() const { return row_addr.size(); }
+
+	/// The number of non-zero entries
+	inline size_t nnz() const { return col.size(); }
+
+	/// The row of source \c src, or \c rows() if it sends no traffic
+	size_t row(host_addr src) const;
+
+	/// The entries of source \c src are in [row_begin(src), row_end(src))
+	inline size_t row_begin(host_addr src) const { 
+		return row_ptr[std::lower_bound(row_addr.begin(), row_addr.end(), src) 
+			- row_addr.begin()];
+	}
+	inline size_t row_end(host_addr src) const { 
+		return row_ptr[std::upper_bound(row_addr.begin(), row_addr.end(), src) 
+			- row_addr.begin()];
+	}
+
+	/// The index of entry (src, dst), or \c nnz() if it is zero
+	size_t find(host_addr src, host_addr dst) const;
+
+	/// The total messages and bytes in the matrix
+	size_t total_msgs() const;
+	size_t total_bytes() const;
+};
+
+
+} // end namespace dsarch
@@ -0,0 +1,327 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dsarch_snapshot.hh"
+
+namespace dsarch {
+
+using namespace std;
+
+static_assert(sizeof(size_t) == sizeof(uint64_t),
+	"snapshots require 64-bit counters");
+
+static const char snapshot_magic[4] = { 'D', 'S', 'N', 'P' };
+static const uint32_t snapshot_version = 1;
+
+namespace {
+
+struct snapshot_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t slots;			// attribute slots, a multiple of 64
+	uint64_t counters;		// counter slots
+	uint64_t nhosts;
+	uint64_t proto_off, proto_len;
+	uint64_t cols_off, cols_len;
+	uint64_t hosts_off, hosts_len;
+	uint64_t names_off, names_len;
+};
+
+static_assert(sizeof(snapshot_header) == 96, "unexpected header layout");
+
+inline size_t align8(size_t n) { return (n+7) & ~size_t(7); }
+
+inline size_t columns_length(size_t slots, size_t counters)
+{
+	return slots/8 + slots*(2*sizeof(host_addr) + sizeof(rpcc_t) + 1)
+		+ 4*counters*sizeof(size_t);
+}
+
+// protocol encoding
+
+inline void put_u32(string& buf, uint32_t v)
+{
+	buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+inline void put_str(string& buf, const string& s)
+{
+	put_u32(buf, s.size());
+	buf.append(s);
+}
+
+struct proto_decoder
+{
+	const char* p;
+	const char* end;
+
+	void need(size_t n) {
+		if(size_t(end-p) < n)
+			throw std::runtime_error("corrupt snapshot protocol");
+	}
+	uint32_t u32() {
+		uint32_t v;
+		need(sizeof(v));
+		memcpy(&v, p, sizeof(v));
+		p += sizeof(v);
+		return v;
+	}
+	uint8_t u8() { need(1); return uint8_t(*p++); }
+	string str() {
+		uint32_t n = u32();
+		need(n);
+		string s(p, n);
+		p += n;
+		return s;
+	}
+};
+
+}  // end anonymous namespace
+
+
+
+//-------------------
+//
+//  snapshot writer
+//
+//-------------------
+
+
+static string encode_protocol(const rpc_protocol& rpc)
+{
+	string buf;
+	put_str(buf, rpc.name());
+	put_u32(buf, rpc.ifaces.size());
+	for(auto& ifc : rpc.ifaces) {
+		put_str(buf, ifc.name());
+		put_u32(buf, ifc.methods.size());
+		for(auto& m : ifc.methods) {
+			put_str(buf, m.name());
+			buf.push_back(char(m.one_way));
+		}
+	}
+	return buf;
+}
+
+
+void write_snapshot(const network& nw, const string& path)
+{
+	const channel_attrs& at = nw.attrs();
+	const channel_counters& ct = nw.counters();
+
+	// the hosts, in address order
+	vector<host*> hosts(nw.hosts().begin(), nw.hosts().end());
+	hosts.insert(hosts.end(), nw.groups().begin(), nw.groups().end());
+	std::sort(hosts.begin(), hosts.end(),
+		[](host* a, host* b) { return a->addr() < b->addr(); });
+
+	vector<host_addr> addrs;
+	vector<uint64_t> name_offs;
+	string names;
+	addrs.reserve(hosts.size());
+	name_offs.reserve(hosts.size()+1);
+	for(auto h : hosts) {
+		addrs.push_back(h->addr());
+		name_offs.push_back(names.size());
+		names.append(h->name());
+	}
+	name_offs.push_back(names.size());
+
+	string proto = encode_protocol(nw.rpc());
+
+	snapshot_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, snapshot_magic, 4);
+	hdr.version = snapshot_version;
+	hdr.slots = at.src.size();
+	hdr.counters = ct.size();
+	hdr.nhosts = hosts.size();
+	hdr.proto_off = sizeof(hdr);
+	hdr.proto_len = proto.size();
+	hdr.cols_off = align8(hdr.proto_off + hdr.proto_len);
+	hdr.cols_len = columns_length(hdr.slots, hdr.counters);
+	hdr.hosts_off = hdr.cols_off + hdr.cols_len;
+	hdr.hosts_len = align8(hdr.nhosts*sizeof(host_addr))
+		+ name_offs.size()*sizeof(uint64_t);
+	hdr.names_off = hdr.hosts_off + hdr.hosts_len;
+	hdr.names_len = names.size();
+
+	std::FILE* f = fopen(path.c_str(), "wb");
+	if(f == nullptr)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open snapshot file " + path);
+
+	size_t pos = 0;
+	bool ok = true;
+	auto put = [&](const void* data, size_t len) {
+		if(len > 0)
+			ok = ok && fwrite(data, 1, len, f) == len;
+		pos += len;
+	};
+	auto pad = [&]() {
+		static const char zeros[8] = { 0 };
+		put(zeros, align8(pos) - pos);
+	};
+
+	put(&hdr, sizeof(hdr));
+	put(proto.data(), proto.size());
+	pad();
+
+	assert(pos == hdr.cols_off);
+	put(at.live.data(), hdr.slots/8);
+	put(at.src.data(), hdr.slots*sizeof(host_addr));
+	put(at.dst.data(), hdr.slots*sizeof(host_addr));
+	put(at.rpcc.data(), hdr.slots*sizeof(rpcc_t));
+	put(at.mcast.data(), hdr.slots);
+	put(ct.msgs.data(), hdr.counters*sizeof(size_t));
+	put(ct.byts.data(), hdr.counters*sizeof(size_t));
+	put(ct.rxmsgs.data(), hdr.counters*sizeof(size_t));
+	put(ct.rxbyts.data(), hdr.counters*sizeof(size_t));
+
+	assert(pos == hdr.hosts_off);
+	put(addrs.data(), addrs.size()*sizeof(host_addr));
+	pad();
+	put(name_offs.data(), name_offs.size()*sizeof(uint64_t));
+
+	assert(pos == hdr.names_off);
+	put(names.data(), names.size());
+
+	if(fclose(f) != 0 || ! ok)
+		throw std::runtime_error("error writing snapshot file " + path);
+}
+
+
+
+//-------------------
+//
+//  snapshot reader
+//
+//-------------------
+
+
+snapshot::snapshot(const string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open snapshot file " + path);
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		int err = errno;
+		close(fd);
+		throw std::system_error(err, std::generic_category(),
+			"cannot stat snapshot file " + path);
+	}
+	length = st.st_size;
+	if(length < sizeof(snapshot_header)) {
+		close(fd);
+		throw std::runtime_error("not a snapshot file: " + path);
+	}
+
+	void* m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot map snapshot file " + path);
+	base = static_cast<const char*>(m);
+
+	try {
+		const snapshot_header& hdr =
+			*reinterpret_cast<const snapshot_header*>(base);
+		if(memcmp(hdr.magic, snapshot_magic, 4) != 0)
+			throw std::runtime_error("not a snapshot file: " + path);
+		if(hdr.version != snapshot_version)
+			throw std::runtime_error("unsupported snapshot version in " + path);
+
+		// check the section bounds
+		auto check = [&](uint64_t off, uint64_t len) {
+			if(off > length || len > length - off || off % 8 != 0)
+				throw std::runtime_error("corrupt snapshot file " + path);
+		};
+		// the counts are bounded by the file length, so that the 
+		// section lengths cannot overflow
+		if(hdr.slots > length || hdr.counters > length 
+				|| hdr.nhosts > length)
+			throw std::runtime_error("corrupt snapshot file " + path);
+		if(hdr.slots % 64 != 0
+			|| hdr.cols_len != columns_length(hdr.slots, hdr.counters)
+			|| hdr.hosts_len != align8(hdr.nhosts*sizeof(host_addr))
+				+ (hdr.nhosts+1)*sizeof(uint64_t))
+			throw std::runtime_error("corrupt snapshot file " + path);
+		check(hdr.proto_off, hdr.proto_len);
+		check(hdr.cols_off, hdr.cols_len);
+		check(hdr.hosts_off, hdr.hosts_len);
+		check(hdr.names_off, hdr.names_len);
+
+		// rebuild the protocol; declaring in order reproduces the codes
+		proto_decoder dec { base + hdr.proto_off,
+			base + hdr.proto_off + hdr.proto_len };
+		rpctab.set_name(dec.str());
+		for(uint32_t i = dec.u32(); i>0; i--) {
+			rpcc_t ifc = rpctab.declare(dec.str());
+			for(uint32_t j = dec.u32(); j>0; j--) {
+				string mname = dec.str();
+				rpctab.declare(ifc, mname, dec.u8());
+			}
+		}
+
+		// the columns
+		const char* p = base + hdr.cols_off;
+		auto column = [&](auto*& ptr, size_t n) {
+			ptr = reinterpret_cast<std::remove_reference_t<decltype(ptr)>>(p);
+			p += n * sizeof(*ptr);
+		};
+		cols.slots = hdr.slots;
+		cols.counters = hdr.counters;
+		column(cols.live, hdr.slots/64);
+		column(cols.src, hdr.slots);
+		column(cols.dst, hdr.slots);
+		column(cols.rpcc, hdr.slots);
+		column(cols.mcast, hdr.slots);
+		column(cols.msgs, hdr.counters);
+		column(cols.byts, hdr.counters);
+		column(cols.rxmsgs, hdr.counters);
+		column(cols.rxbyts, hdr.counters);
+		cols.rpc = &rpctab;
+
+		// the hosts
+		nhosts = hdr.nhosts;
+		addrs = reinterpret_cast<const host_addr*>(base + hdr.hosts_off);
+		name_offs = reinterpret_cast<const uint64_t*>(base + hdr.hosts_off
+			+ align8(nhosts*sizeof(host_addr)));
+		names = base + hdr.names_off;
+		if(! std::is_sorted(name_offs, name_offs+nhosts+1)
+				|| name_offs[nhosts] > hdr.names_len
+				|| ! std::is_sorted(addrs, addrs+nhosts))
+			throw std::runtime_error("corrupt snapshot file " + path);
+	} catch(...) {
+		munmap(const_cast<char*>(base), length);
+		throw;
+	}
+}
+
+
+snapshot::~snapshot()
+{
+	munmap(const_cast<char*>(base), length);
+}
+
+
+size_t snapshot::find(host_addr a) const
+{
+	const host_addr* it = std::lower_bound(addrs, addrs+nhosts, a);
+	if(it != addrs+nhosts && *it == a)
+		return it - addrs;
+	return nhosts;
+}
+
+
+} // end namespace dsarch
@@ -0,0 +1,103 @@
+/**
+	\file Binary statistics snapshots.
+
+	A snapshot stores the statistics of a network at the end of a run:
+	the rpc protocol, the addresses and names of all hosts, and the
+	attribute and counter columns of all channels. Snapshots are meant
+	for offline analysis of large parameter sweeps, where printing every
+	channel as text is too slow.
+
+	A snapshot is written with a few bulk writes, one per column, and
+	loaded by mapping the file in memory. The columns are not copied;
+	queries over a loaded snapshot read the mapped file directly.
+
+	The format of a snapshot file is a 96-byte header, followed by
+	sections aligned at 8 bytes. The header consists of the magic
+	string "DSNP", a 32-bit version, and eleven 64-bit fields:
+	the number of attribute slots, the number of counter slots, the
+	number of hosts, and the offsets and lengths of the sections.
+	All numbers are in the byte order of the machine that wrote the
+	snapshot.
+  */
+
+#pragma once
+
+#include <string_view>
+
+#include "dsarch.hh"
+
+namespace dsarch {
+
+
+/**
+	Write a snapshot of the statistics of a network to a file.
+
+	If counters are sharded, they are merged first.
+  */
+void write_snapshot(const network& nw, const string& path);
+
+
+/**
+	A read-only snapshot of network statistics, mapped from a file.
+
+	The channel columns of the snapshot are accessed via \c query(),
+	which supports the same filters and tallies as over a live network.
+	Channel ids in the snapshot are the channel ids of the network at
+	the time the snapshot was written.
+
+	Queries over a snapshot refer to the mapped memory, therefore the
+	snapshot must outlive them.
+  */
+class snapshot
+{
+public:
+	/**
+		Map a snapshot file. The layout of the file is checked, so 
+		that a corrupt file throws \c std::runtime_error rather than
+		reading out of the mapping later.
+	  */
+	snapshot(const string& path);
+	~snapshot();
+
+	snapshot(const snapshot&) = delete;
+	snapshot& operator=(const snapshot&) = delete;
+
+	/// The rpc protocol of the network
+	inline const rpc_protocol& rpc() const { return rpctab; }
+
+	/// The channel columns
+	inline const chan_columns& columns() const { return cols; }
+
+	/// A query over all the channels of the snapshot
+	inline chan_query query() const { return chan_query(cols); }
+
+	/// The number of hosts (including groups)
+	inline size_t num_hosts() const { return nhosts; }
+
+	/// The address of the i-th host, in address order
+	inline host_addr addr(size_t i) const { return addrs[i]; }
+
+	/// The name of the i-th host, in address order
+	inline std::string_view name(size_t i) const {
+		return std::string_view(names + name_offs[i],
+			name_offs[i+1] - name_offs[i]);
+	}
+
+	/// The index of a host address, or \c num_hosts() if not found
+	size_t find(host_addr a) const;
+
+private:
+	const char* base = nullptr;
+	size_t length = 0;
+
+	chan_columns cols;
+	rpc_protocol rpctab;
+
+	size_t nhosts = 0;
+	const host_addr* addrs = nullptr;
+	const uint64_t* name_offs = nullptr;
+	const char* names = nullptr;
+};
+
+
+} // end namespace dsarch
@@ -1,10 +1,16 @@
 
 #include <memory>
 #include <string>
+#include <thread>
 #include <boost/range/adaptors.hpp>
 
 #include <cxxtest/TestSuite.h>
+
 #include "dsarch.hh"
+#include "dsarch_async.hh"
+#include "dsarch_trace.hh"
+#include "dsarch_snapshot.hh"
+#include "dsarch_matrix.hh"
 
 using namespace dsarch;
 using std::string;
@@ -22,6 +28,22 @@ struct Echo_network : network
 	{}
 };
 
+// A network with custom channels
+struct counted_channel : channel
+{
+	static int live;
+	counted_channel(host* s, host* d, rpcc_t e) : channel(s, d, e) { live++; }
+	~counted_channel() { live--; }
+};
+int counted_channel::live = 0;
+
+struct Custom_network : Echo_network
+{
+	channel* create_channel(host* src, host* dst, rpcc_t endp) const override {
+		return new counted_channel(src, dst, endp);
+	}
+};
+
 
 struct Echo : host
 {
@@ -70,6 +92,18 @@ struct Echo_proxy : remote_proxy<Echo>
 	{}
 };
 
+struct Echo_async_proxy : remote_proxy<Echo>
+{
+	REMOTE_ASYNC(Echo, echo);
+	REMOTE_ASYNC(Echo, send_int);
+	REMOTE_ASYNC(Echo, add);
+	REMOTE_ASYNC(Echo, finish);
+
+	Echo_async_proxy(host* owner) 
+	: remote_proxy<Echo>(owner)
+	{}
+};
+
 struct Echo_cli : host
 {
 	Echo_proxy proxy;
@@ -199,6 +233,164 @@ void Peer::change_key(int newkey)
 
 
 
+/****************************************
+	A ring of relays, for the executor.
+
+	Each relay forwards a token to the next
+	relay in the ring, until the token's hops
+	are exhausted.
+*****************************************/
+
+struct Relay;
+struct Relay_proxy;
+
+struct Relay : host
+{
+	proxy_map<Relay_proxy, Relay> relays;
+	Relay* next = nullptr;
+	size_t handled = 0;
+	std::atomic<bool> busy { false };
+	bool overlapped = false;
+
+	Relay(network* nw) : host(nw), relays(this) {}
+
+	oneway pass(int hops);
+};
+
+struct Relay_proxy : remote_proxy<Relay>
+{
+	REMOTE_METHOD(Relay, pass);
+	Relay_proxy(host* owner) : remote_proxy<Relay>(owner) {}
+};
+
+oneway Relay::pass(int hops) 
+{
+	if(busy.exchange(true)) overlapped = true;
+	handled++;
+	busy = false;
+	if(hops>0) relays[next].pass(hops-1);
+}
+
+
+// a host with one-way and two-way calls, that detects overlaps
+struct Tally;
+struct Tally_proxy;
+
+struct Tally : host
+{
+	proxy_map<Tally_proxy, Tally> peers;
+	size_t count = 0;
+	std::atomic<bool> busy { false };
+	bool overlapped = false;
+
+	Tally(network* nw) : host(nw), peers(this) {}
+
+	oneway bump();
+	size_t read();
+	size_t ask(sender<Tally> s);
+};
+
+struct Tally_proxy : remote_proxy<Tally>
+{
+	REMOTE_METHOD(Tally, bump);
+	REMOTE_METHOD(Tally, read);
+	REMOTE_METHOD(Tally, ask);
+	Tally_proxy(host* owner) : remote_proxy<Tally>(owner) {}
+};
+
+oneway Tally::bump()
+{
+	if(busy.exchange(true)) overlapped = true;
+	count++;
+	busy = false;
+}
+
+size_t Tally::read()
+{
+	if(busy.exchange(true)) overlapped = true;
+	size_t c = count;
+	busy = false;
+	return c;
+}
+
+// call back the sender, which is waiting for the answer
+size_t Tally::ask(sender<Tally> s)
+{
+	if(busy.exchange(true)) overlapped = true;
+	busy = false;
+	return peers[s.value].read();
+}
+
+
+// a group member that recruits new members when called
+struct Recruiter;
+struct Recruiter_proxy;
+
+struct Recruiter : host
+{
+	proxy_map<Recruiter_proxy, Recruiter> peers;
+	mcast_group<Recruiter>* group = nullptr;
+	vector<std::unique_ptr<Recruiter>>* recruits = nullptr;
+	size_t called = 0;
+
+	Recruiter(network* nw) : host(nw), peers(this) {}
+
+	oneway recruit(int n);
+	oneway quit();
+};
+
+struct Recruiter_proxy : remote_proxy<Recruiter>
+{
+	REMOTE_METHOD(Recruiter, recruit);
+	REMOTE_METHOD(Recruiter, quit);
+	Recruiter_proxy(host* owner) : remote_proxy<Recruiter>(owner) {}
+};
+
+oneway Recruiter::recruit(int n)
+{
+	called++;
+	for(int i=0; i<n; i++) {
+		Recruiter* r = new Recruiter(net());
+		r->group = group;
+		r->recruits = recruits;
+		recruits->emplace_back(r);
+		group->join(r);
+	}
+}
+
+oneway Recruiter::quit()
+{
+	called++;
+	group->leave(this);
+}
+
+
+/****************************************
+	Coroutines for asynchronous calls
+*****************************************/
+
+// add up the responses of many servers, with all calls in flight
+static task<int> fan_out(vector<Echo_async_proxy*>& prx, int x)
+{
+	vector<call_task<int>> calls;
+	for(auto p : prx)
+		calls.push_back(p->add(x, 1));
+	int total = 0;
+	for(auto& c : calls)
+		total += co_await c;
+	co_return total;
+}
+
+static task<> ping_pong(Echo_async_proxy* prx, vector<string>& log)
+{
+	log.push_back(co_await prx->echo("a"));
+	auto ack = co_await prx->send_int(-1);
+	if(! ack) log.push_back("nak");
+	co_await prx->finish();
+	log.push_back("done");
+}
+
+
 //
 //  Test suite
 //
@@ -245,9 +437,11 @@ public:
 										nw.decl_interface(typeid(Echo)));
 			TS_ASSERT_EQUALS(cli[i]->proxy._r_owner, cli[i]);
 			TS_ASSERT_EQUALS(cli[i]->proxy._r_proc, srv);
-			TS_ASSERT_EQUALS(cli[i]->proxy._r_calls.size(), 7);
-			for(size_t j=0;j<cli[i]->proxy._r_calls.size();j++) {
-				TS_ASSERT_EQUALS(cli[i]->proxy._r_calls[j]->endpoint(), 
+			TS_ASSERT_EQUALS(cli[i]->proxy.proc(), srv);
+			TS_ASSERT(! cli[i]->proxy.is_multicast());
+			TS_ASSERT_EQUALS(cli[i]->proxy._r_size(), 7);
+			for(size_t j=0;j<cli[i]->proxy._r_size();j++) {
+				TS_ASSERT_EQUALS(cli[i]->proxy._r_endpoint(j), 
 					Echo_ifc| 2*(j+1));
 			}
 		}
@@ -260,6 +454,1264 @@ public:
 	}
 
 
+	void test_connect_index()
+	{
+		Echo_network nw;
+
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+
+		rpcc_t ifc = nw.decl_interface(typeid(Echo));
+		rpcc_t m1 = nw.decl_method(ifc, "say_bye", true);
+		rpcc_t m2 = nw.decl_method(ifc, "finish", true);
+
+		channel* c1 = nw.connect(cli, srv, m1);
+		TS_ASSERT_EQUALS(nw.connect(cli, srv, m1), c1);
+		TS_ASSERT_DIFFERS(nw.connect(cli, srv, m2), c1);
+		TS_ASSERT_DIFFERS(nw.connect(srv, cli, m1), c1);
+		TS_ASSERT_EQUALS(nw.channels().size(), 3);
+
+		size_t cid1 = c1->id();
+		TS_ASSERT_EQUALS(nw.channel_by_id(cid1), c1);
+		c1->transmit(10);
+		nw.disconnect(c1);
+		TS_ASSERT_EQUALS(nw.channels().size(), 2);
+		TS_ASSERT(nw.channel_by_id(cid1) == nullptr);
+		channel* c2 = nw.connect(cli, srv, m1);
+		TS_ASSERT_EQUALS(c2->source(), cli);
+		TS_ASSERT_EQUALS(nw.channels().size(), 3);
+		// channel ids are reused, with cleared counters
+		TS_ASSERT_EQUALS(c2->id(), cid1);
+		TS_ASSERT_EQUALS(c2->messages(), 0);
+		TS_ASSERT_EQUALS(nw.counters().size(), 3);
+
+		delete cli;
+		delete srv;
+	}
+
+
+	void test_arena()
+	{
+		// custom channels are still created and deleted by the subclass
+		{
+			Custom_network nw;
+			Echo* srv = new Echo(&nw);
+			Echo_cli* cli = new Echo_cli(&nw);
+			cli->proxy <<= srv;
+			TS_ASSERT_EQUALS(counted_channel::live, 12);
+			TS_ASSERT_EQUALS( cli->send_echo("Hi"), "Echoing Hi" );
+			delete cli;
+			TS_ASSERT_EQUALS(counted_channel::live, 0);
+			delete srv;
+		}
+
+		// default channels and channel slots come from the arena, and
+		// are released with the network
+		network nw;
+		nw.arena().set_huge_pages(true);
+		const size_t N = 50;
+		vector<Relay*> R;
+		for(size_t i=0; i<N; i++)
+			R.push_back(new Relay(&nw));
+		for(auto r : R) r->relays.add_sites(R);
+		TS_ASSERT_EQUALS(nw.channels().size(), N*(N-1));
+		TS_ASSERT(nw.arena().reserved() > 0);
+		R[0]->relays[R[1]].pass(0);
+		TS_ASSERT_EQUALS(R[1]->handled, 1);
+
+		// freed slots are reused
+		size_t reserved = nw.arena().reserved();
+		delete R[0];
+		R[0] = new Relay(&nw);
+		R[0]->relays.add_sites(R);
+		TS_ASSERT_EQUALS(nw.arena().reserved(), reserved);
+
+		for(auto r : R) delete r;
+	}
+
+
+	void test_proxy_tables()
+	{
+		// proxies only store a few pointers, plus 4 bytes per method
+		TS_ASSERT(sizeof(Echo_proxy) <= sizeof(rpc_proxy) + 7*sizeof(uint32_t) + 4);
+
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli1 = new Echo_cli(&nw);
+		Echo_cli* cli2 = new Echo_cli(&nw);
+		Echo_async_proxy aprx(cli1);
+
+		// proxies of the same type share their method table
+		TS_ASSERT_EQUALS(cli1->proxy._r_bind, cli2->proxy._r_bind);
+		TS_ASSERT_DIFFERS(cli1->proxy._r_bind, aprx._r_bind);
+		TS_ASSERT_EQUALS(aprx._r_size(), 4);
+		TS_ASSERT_EQUALS(aprx.echo.endpoint(), cli1->proxy.echo.endpoint());
+		TS_ASSERT_EQUALS(aprx.add.endpoint(), cli1->proxy.add.endpoint());
+		TS_ASSERT(cli1->proxy.finish.one_way());
+		TS_ASSERT(! cli1->proxy.add.one_way());
+		TS_ASSERT_EQUALS(cli1->proxy.add._proxy(), &cli1->proxy);
+
+		// no channels before connecting
+		TS_ASSERT(cli1->proxy._r_chans == nullptr);
+		TS_ASSERT(cli1->proxy.add.request_channel() == nullptr);
+
+		cli1->proxy <<= srv;
+		cli2->proxy <<= srv;
+		TS_ASSERT_EQUALS(cli1->proxy.add(1,2), 3);
+		TS_ASSERT_EQUALS(cli2->proxy.echo("x"), "Echoing x");
+		TS_ASSERT_EQUALS(cli1->proxy.add.request_channel()->source(), cli1);
+		TS_ASSERT_EQUALS(cli1->proxy.add.request_channel()->messages(), 1);
+		TS_ASSERT_EQUALS(cli2->proxy.echo.response_channel()->destination(), cli2);
+
+		delete cli1;
+		TS_ASSERT_EQUALS(nw.channels().size(), 12);
+		delete cli2;
+		TS_ASSERT_EQUALS(nw.channels().size(), 0);
+		delete srv;
+	}
+
+
+	void test_proxy_map()
+	{
+		network nw;
+		const size_t N = 40;
+		vector<Relay*> R;
+		for(size_t i=0; i<N; i++)
+			R.push_back(new Relay(&nw));
+		R[0]->set_addr(1000);
+		mcast_group<Relay> group(&nw);
+		for(auto r : R) group.join(r);
+
+		// bulk addition skips the owner, and is idempotent
+		Relay* own = R[5];
+		own->relays.add_sites(R);
+		TS_ASSERT_EQUALS(own->relays.size(), N-1);
+		own->relays.add_sites(R);
+		TS_ASSERT_EQUALS(own->relays.size(), N-1);
+		TS_ASSERT(own->relays.find(own->addr()) == nullptr);
+		for(auto r : R) {
+			if(r == own) continue;
+			Relay_proxy* prx = own->relays.find(r->addr());
+			TS_ASSERT(prx != nullptr);
+			TS_ASSERT_EQUALS(prx, &own->relays[r]);
+			TS_ASSERT_EQUALS(prx->proc(), r);
+		}
+		TS_ASSERT(own->relays.find(999) == nullptr);
+		TS_ASSERT(own->relays.find(5000) == nullptr);
+
+		// proxies of bulk additions are contiguous
+		TS_ASSERT_EQUALS(own->relays.find(R[2]->addr()) + 1,
+			own->relays.find(R[3]->addr()));
+
+		// groups and single additions
+		TS_ASSERT(own->relays.find(group.addr()) == nullptr);
+		own->relays[group].pass(0);
+		TS_ASSERT_EQUALS(own->relays.find(group.addr()), &own->relays[&group]);
+		TS_ASSERT_EQUALS(own->relays.size(), N);
+		for(auto r : R) TS_ASSERT_EQUALS(r->handled, 1);
+
+		R[1]->relays[own].pass(0);
+		TS_ASSERT_EQUALS(own->handled, 2);
+		TS_ASSERT_EQUALS(R[1]->relays.size(), 1);
+
+		proxy_map<Relay_proxy, Relay> unowned;
+		TS_ASSERT_THROWS(unowned.add(R[0]), std::runtime_error);
+		TS_ASSERT_THROWS(unowned.add_sites(R), std::runtime_error);
+
+		// sparse addresses, added one at a time
+		vector<Relay*> S;
+		for(size_t i=0; i<100; i++) {
+			S.push_back(new Relay(&nw));
+			TS_ASSERT(S.back()->set_addr(host_addr(100000000 + (i<<20))));
+			R[1]->relays[S.back()];
+		}
+		TS_ASSERT_EQUALS(R[1]->relays.size(), 101);
+		for(auto r : S)
+			TS_ASSERT_EQUALS(R[1]->relays.find(r->addr())->proc(), r);
+		TS_ASSERT(R[1]->relays.find(100000001) == nullptr);
+		for(auto r : S) delete r;
+
+		for(auto r : R) delete r;
+		TS_ASSERT_EQUALS(nw.channels().size(), 0);
+	}
+
+
+	void test_handler_profile()
+	{
+		// every value is within its bucket, which is narrow
+		for(uint64_t v : { 0ul, 1ul, 7ul, 8ul, 9ul, 15ul, 16ul, 17ul, 1000ul, 
+				123456789ul, ~0ul }) {
+			size_t b = time_histogram::bucket(v);
+			TS_ASSERT(b < time_histogram::num_buckets);
+			TS_ASSERT(time_histogram::bucket_low(b) <= v);
+			TS_ASSERT(v <= time_histogram::bucket_high(b));
+			TS_ASSERT(time_histogram::bucket_high(b) - time_histogram::bucket_low(b)
+				<= v / time_histogram::sub_count);
+		}
+
+		time_histogram th;
+		TS_ASSERT_EQUALS(th.quantile(0.5), 0);
+		for(uint64_t v = 1; v <= 1000; v++) th.record(v);
+		TS_ASSERT_EQUALS(th.count(), 1000);
+		TS_ASSERT_EQUALS(th.min(), 1);
+		TS_ASSERT_EQUALS(th.max(), 1000);
+		TS_ASSERT_DELTA(th.mean(), 500.5, 1e-9);
+		TS_ASSERT_EQUALS(th.quantile(0.0), 1);
+		TS_ASSERT_EQUALS(th.quantile(1.0), 1000);
+		uint64_t med = th.quantile(0.5);
+		TS_ASSERT(med >= 500 && med <= 500 + 500/time_histogram::sub_count);
+		time_histogram th2 = th;
+		th2.merge(th);
+		TS_ASSERT_EQUALS(th2.count(), 2000);
+		TS_ASSERT_EQUALS(th2.quantile(0.5), med);
+		th2.clear();
+		TS_ASSERT_EQUALS(th2.count(), 0);
+
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		const string ifname = 
+			nw.rpc().get_interface(cli->proxy.add.endpoint()).name();
+
+		// not profiling
+		cli->proxy.add(1, 2);
+		TS_ASSERT(nw.handler_profiling() == nullptr);
+		TS_ASSERT(nw.handler_times(ifname, "add") == nullptr);
+		TS_ASSERT_EQUALS(nw.handler_times(ifname).count(), 0);
+
+		nw.set_handler_profiling(true);
+		for(int i = 0; i < 10; i++) cli->proxy.add(i, i);
+		cli->proxy.finish();
+#ifndef DSARCH_PROFILE
+		// handlers are not timed unless configured with --enable-profile
+		TS_ASSERT(nw.handler_times(ifname, "add") == nullptr);
+		TS_ASSERT_EQUALS(nw.handler_times(ifname).count(), 0);
+		delete cli;
+		delete srv;
+		return;
+#endif
+		const time_histogram* h = nw.handler_times(ifname, "add");
+		TS_ASSERT(h != nullptr);
+		TS_ASSERT_EQUALS(h->count(), 10);
+		TS_ASSERT(h->min() <= h->max());
+		TS_ASSERT_EQUALS(h, nw.handler_profiling()->method(cli->proxy.add.endpoint()));
+		TS_ASSERT(nw.handler_times(ifname, "echo") == nullptr);
+		TS_ASSERT(nw.handler_times(ifname, "nosuch") == nullptr);
+		TS_ASSERT(nw.handler_times("nosuch", "add") == nullptr);
+		TS_ASSERT_EQUALS(nw.handler_times(ifname).count(), 11);
+
+		std::set<rpcc_t> timed;
+		nw.handler_profiling()->for_each([&](rpcc_t e, const time_histogram&) {
+			timed.insert(e);
+		});
+		TS_ASSERT(timed == std::set<rpcc_t>({ cli->proxy.add.endpoint(), 
+			cli->proxy.finish.endpoint() }));
+
+		// re-enabling discards previous times
+		nw.set_handler_profiling(true);
+		TS_ASSERT(nw.handler_times(ifname, "add") == nullptr);
+
+		// asynchronous handlers are timed at request delivery
+		{
+			simulator sim(&nw);
+			Echo_cli acli(&nw);
+			Echo_async_proxy prx(&acli);
+			prx <<= srv;
+			vector<Echo_async_proxy*> prxs { &prx };
+			task<int> t = fan_out(prxs, 1);
+			TS_ASSERT(nw.handler_profiling()->method(prx.add.endpoint()) == nullptr);
+			sim.run();
+			TS_ASSERT_EQUALS(t.result(), 2);
+			const time_histogram* ah = nw.handler_profiling()->method(prx.add.endpoint());
+			TS_ASSERT(ah != nullptr);
+			TS_ASSERT_EQUALS(ah->count(), 1);
+		}
+		delete cli;
+		delete srv;
+
+		// multicast handlers are timed per receiver
+		network rnw;
+		rnw.set_handler_profiling(true);
+		mcast_group<Relay> group(&rnw);
+		vector<Relay*> R;
+		for(size_t i = 0; i < 5; i++) {
+			R.push_back(new Relay(&rnw));
+			group.join(R.back());
+		}
+		R[0]->relays[group].pass(0);
+		const time_histogram* mh = 
+			rnw.handler_profiling()->method(R[0]->relays[group].pass.endpoint());
+		TS_ASSERT(mh != nullptr);
+		TS_ASSERT_EQUALS(mh->count(), 5);
+
+		// the profile cannot be replaced under running threads
+		{
+			fanout_pool pool(&rnw, 2, 1);
+			TS_ASSERT_THROWS(rnw.set_handler_profiling(false), std::logic_error);
+			TS_ASSERT_THROWS(rnw.set_handler_profiling(true), std::logic_error);
+			R[0]->relays[group].pass(0);
+		}
+		{
+			executor ex(&rnw, 2);
+			TS_ASSERT_THROWS(rnw.set_handler_profiling(false), std::logic_error);
+		}
+		TS_ASSERT_EQUALS(mh, rnw.handler_profiling()->method(R[0]->relays[group].pass.endpoint()));
+		TS_ASSERT_EQUALS(mh->count(), 10);
+		rnw.set_handler_profiling(false);
+		TS_ASSERT(rnw.handler_profiling() == nullptr);
+		for(auto r : R) delete r;
+	}
+
+
+	void test_lazy_channels()
+	{
+		Echo_network nw;
+		nw.set_lazy_channels(true);
+		TS_ASSERT(nw.lazy_channels());
+
+		Echo* srv = new Echo(&nw);
+		Echo* srv2 = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		TS_ASSERT_EQUALS(nw.channels().size(), 0);
+		TS_ASSERT(cli->proxy.add.request_channel() == nullptr);
+
+		TS_ASSERT_EQUALS(cli->proxy.add(1, 2), 3);
+		TS_ASSERT_EQUALS(nw.channels().size(), 2);
+		TS_ASSERT_EQUALS(cli->proxy.add.request_channel()->destination(), srv);
+
+		// a NAK response does not open the response channel
+		TS_ASSERT(! cli->proxy.send_int(-1));
+		TS_ASSERT_EQUALS(nw.channels().size(), 3);
+		TS_ASSERT(cli->proxy.send_int.response_channel() == nullptr);
+
+		chan_frame cf(nw);
+		TS_ASSERT_EQUALS(cf.size(), 3);
+		TS_ASSERT_EQUALS(cf.msgs(), 3);
+
+		// reconnecting opens channels to the new destination
+		cli->proxy <<= srv2;
+		cli->proxy.say_bye("bye");
+		TS_ASSERT_EQUALS(srv2->value, -1);
+		TS_ASSERT_EQUALS(cli->proxy.say_bye.request_channel()->destination(), srv2);
+		TS_ASSERT_EQUALS(chan_query(nw).dst(srv2).size(), 1);
+
+		TS_ASSERT_THROWS(executor(&nw, 1), std::logic_error);
+
+		delete cli;
+		delete srv;
+		delete srv2;
+	}
+
+
+	void test_sharded_counters()
+	{
+		Echo_network nw;
+		nw.set_sharded_counters(true);
+		TS_ASSERT(nw.sharded_counters());
+
+		Echo* srv = new Echo(&nw);
+		const size_t Ncli = 4;
+		Echo_cli* cli[Ncli];
+		for(size_t i=0;i<Ncli;i++) { 
+			cli[i] = new Echo_cli(&nw);
+			cli[i]->proxy <<= srv;
+		}
+
+		// every client calls the server from its own thread,
+		// all threads share the server's channels
+		const int N = 10000;
+		rpcc_t ping = nw.decl_method(nw.decl_interface(typeid(Echo)), "ping", true);
+		channel* shared = nw.connect(cli[0], srv, ping);
+		vector<std::thread> workers;
+		for(size_t i=0;i<Ncli;i++)
+			workers.emplace_back([&,i]() {
+				for(int k=0;k<N;k++) {
+					cli[i]->proxy.add(k, 1);
+					shared->transmit(1);
+				}
+			});
+		for(auto& t : workers) t.join();
+
+		chan_frame cf(nw);
+		TS_ASSERT_EQUALS(shared->messages(), Ncli*N);
+		TS_ASSERT_EQUALS(cf.endp("Echo","add").endp_req().msgs(), Ncli*N);
+		TS_ASSERT_EQUALS(cf.endp("Echo","add").endp_rsp().bytes(), Ncli*N*sizeof(int));
+		TS_ASSERT_EQUALS(chan_query(nw).msgs(), 3*Ncli*N);
+		TS_ASSERT_EQUALS(nw.method_traffic("Echo","add").msgs, 2*Ncli*N);
+
+		// queries tally the current counters, not those at construction
+		chan_query sq = chan_query(nw).src(cli[0]).endp(ping, ~rpcc_t(0));
+		size_t before = sq.msgs();
+		for(int k=0;k<5;k++) shared->transmit(1);
+		TS_ASSERT_EQUALS(sq.msgs(), before+5);
+		TS_ASSERT_EQUALS(sq.msgs(), shared->messages());
+
+		// switching off merges the shards
+		cli[0]->proxy.finish();
+		nw.set_sharded_counters(false);
+		TS_ASSERT_EQUALS(cf.endp("Echo","finish").msgs(), 1);
+
+		for(size_t i=0;i<Ncli;i++) 
+			delete cli[i];
+		delete srv;
+	}
+
+
+	void test_traffic_totals()
+	{
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		Echo_cli* cli2 = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		cli2->proxy <<= srv;
+		for(int k=0;k<10;k++) cli->proxy.add(k, 1);
+		for(int k=0;k<5;k++) cli2->proxy.add(k, 1);
+		cli->proxy.say_bye("bye");
+
+		// the totals agree with scanning the channels
+		chan_frame cf(nw);
+		rpcc_t add = nw.rpc().code("Echo", "add");
+		traffic_totals t = nw.endpoint_traffic(add);
+		TS_ASSERT_EQUALS(t.msgs, 15);
+		TS_ASSERT_EQUALS(t.byts, cf.endp("Echo","add").endp_req().bytes());
+		t = nw.method_traffic("Echo", "add");
+		TS_ASSERT_EQUALS(t.msgs, 30);
+		TS_ASSERT_EQUALS(t.byts, cf.endp("Echo","add").bytes());
+		t = nw.interface_traffic("Echo");
+		TS_ASSERT_EQUALS(t.msgs, cf.endp("Echo").msgs());
+		TS_ASSERT_EQUALS(t.byts, cf.endp("Echo").bytes());
+		TS_ASSERT_EQUALS(t.rxmsgs, 0);
+		TS_ASSERT_EQUALS(nw.method_traffic("Echo", "nosuch").msgs, 0);
+		TS_ASSERT_EQUALS(nw.interface_traffic("Nosuch").msgs, 0);
+
+		// disconnected channels are deducted
+		delete cli;
+		TS_ASSERT_EQUALS(nw.method_traffic("Echo", "add").msgs, 10);
+		TS_ASSERT_EQUALS(nw.interface_traffic("Echo").msgs, chan_frame(nw).msgs());
+		delete cli2;
+		TS_ASSERT_EQUALS(nw.interface_traffic("Echo").msgs, 0);
+		delete srv;
+
+		// multicast counts deliveries
+		network rnw;
+		mcast_group<Relay> group(&rnw);
+		vector<Relay*> R;
+		for(size_t i = 0; i < 5; i++) {
+			R.push_back(new Relay(&rnw));
+			group.join(R.back());
+		}
+		R[0]->relays[group].pass(0);
+		auto mc = R[0]->relays[group].pass.request_channel();
+		t = rnw.endpoint_traffic(mc->rpc_code());
+		TS_ASSERT_EQUALS(t.msgs, 1);
+		TS_ASSERT_EQUALS(t.rxmsgs, static_cast<multicast_channel*>(mc)->messages_received());
+		TS_ASSERT_EQUALS(t.rxbyts, static_cast<multicast_channel*>(mc)->bytes_received());
+		for(auto r : R) delete r;
+	}
+
+
+	void test_hotspots()
+	{
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		const size_t Ncli = 5;
+		vector<Echo_cli*> cli;
+		for(size_t i=0; i<Ncli; i++) {
+			cli.push_back(new Echo_cli(&nw));
+			cli.back()->proxy <<= srv;
+			for(size_t k=0; k<=i; k++) cli.back()->proxy.add(1, 2);
+		}
+
+		// the server receives every request and sends every response
+		traffic_totals t = nw.host_traffic(srv);
+		TS_ASSERT_EQUALS(t.rxmsgs, 15);
+		TS_ASSERT_EQUALS(t.msgs, 15);
+		TS_ASSERT_EQUALS(t.msgs, chan_frame(nw).src(srv).msgs());
+		TS_ASSERT_EQUALS(t.rxbyts, chan_frame(nw).dst(srv).bytes());
+		TS_ASSERT_EQUALS(nw.host_traffic(cli[4]).msgs, 5);
+		TS_ASSERT_EQUALS(nw.host_traffic(cli[4]).rxmsgs, 5);
+
+		hotspot_report rep = nw.hotspots(2);
+		TS_ASSERT_EQUALS(rep.hosts, Ncli+1);
+		TS_ASSERT_EQUALS(rep.total, 60);
+		TS_ASSERT_EQUALS(rep.top.size(), 2);
+		TS_ASSERT_EQUALS(rep.top[0].h, srv);
+		TS_ASSERT_EQUALS(rep.top[0].load, 30);
+		TS_ASSERT_EQUALS(rep.top[1].h, cli[4]);
+		TS_ASSERT_EQUALS(rep.max, 30);
+		TS_ASSERT_EQUALS(rep.min, 2);
+		TS_ASSERT_EQUALS(rep.median, 8);
+		TS_ASSERT_DELTA(rep.mean, 10.0, 1e-9);
+		TS_ASSERT_DELTA(rep.imbalance, 3.0, 1e-9);
+		TS_ASSERT_DELTA(rep.top_share, 40.0/60, 1e-9);
+		TS_ASSERT(rep.gini > 0.0 && rep.gini < 1.0);
+		TS_ASSERT(nw.hotspots(2, true).top[0].load > rep.top[0].load);
+		TS_ASSERT_EQUALS(nw.hotspots(100).top.size(), Ncli+1);
+
+		// totals survive disconnection
+		delete cli[0];
+		TS_ASSERT_EQUALS(nw.host_traffic(srv).rxmsgs, 15);
+		for(size_t i=1; i<Ncli; i++) delete cli[i];
+		delete srv;
+
+		// every delivery of a multicast is received
+		network rnw;
+		mcast_group<Relay> group(&rnw);
+		vector<Relay*> R;
+		for(size_t i = 0; i < 5; i++) {
+			R.push_back(new Relay(&rnw));
+			group.join(R.back());
+		}
+		group.leave(R[2]);
+		R[0]->relays[group].pass(0);
+		R[1]->relays[group].pass(0);
+		TS_ASSERT_EQUALS(rnw.host_traffic(R[0]).msgs, 1);
+		TS_ASSERT_EQUALS(rnw.host_traffic(R[0]).rxmsgs, 1);
+		TS_ASSERT_EQUALS(rnw.host_traffic(R[2]).rxmsgs, 0);
+		TS_ASSERT_EQUALS(rnw.host_traffic(R[3]).rxmsgs, 2);
+		TS_ASSERT_EQUALS(rnw.hotspots(1).total, 2+6);
+		for(auto r : R) delete r;
+
+		// totals are indexed densely, however sparse the addresses
+		network snw;
+		mcast_group<Relay> sgroup(&snw);
+		Relay* far = new Relay(&snw);
+		TS_ASSERT(far->set_addr(100000000));
+		Relay* near = new Relay(&snw);
+		TS_ASSERT_EQUALS(far->index(), 0);
+		TS_ASSERT_EQUALS(near->index(), 1);
+		sgroup.join(far);
+		sgroup.join(near);
+		near->relays.add(far);
+		near->relays[far].pass(0);
+		near->relays[sgroup].pass(0);
+		TS_ASSERT_EQUALS(snw.host_traffic(100000000).rxmsgs, 2);
+		TS_ASSERT_EQUALS(snw.host_traffic(near).msgs, 2);
+		TS_ASSERT_EQUALS(snw.host_traffic(near).rxmsgs, 0);
+		TS_ASSERT_EQUALS(snw.hotspots(2).top[1].addr, 100000000);
+		TS_ASSERT_EQUALS(sgroup.size(), 2);
+		TS_ASSERT_EQUALS(sgroup.index(), host::no_index);
+		delete near;
+		delete far;
+	}
+
+
+	void test_executor()
+	{
+		network nw;
+		const size_t N = 16;
+		const int H = 1000;
+		vector<Relay*> R;
+		for(size_t i=0; i<N; i++)
+			R.push_back(new Relay(&nw));
+		for(size_t i=0; i<N; i++) {
+			R[i]->next = R[(i+1)%N];
+			R[i]->relays.add(R[i]->next);
+		}
+
+		{
+			executor ex(&nw, 4);
+			TS_ASSERT_EQUALS(nw.exec(), &ex);
+			TS_ASSERT(nw.sharded_counters());
+
+			// every relay starts a token
+			for(size_t i=0; i<N; i++)
+				ex.post(R[i], [&,i]() { R[i]->pass(H); });
+			ex.wait();
+		}
+		TS_ASSERT(nw.exec() == nullptr);
+
+		size_t handled = 0;
+		for(auto r : R) {
+			handled += r->handled;
+			TS_ASSERT(! r->overlapped);
+		}
+		TS_ASSERT_EQUALS(handled, N*(H+1));
+
+		chan_frame cf(nw);
+		TS_ASSERT_EQUALS(cf.size(), N);
+		TS_ASSERT_EQUALS(cf.msgs(), N*H);
+		TS_ASSERT_EQUALS(cf.bytes(), N*H*sizeof(int));
+
+		for(auto r : R) delete r;
+	}
+
+
+	void test_executor_twoway()
+	{
+		network nw;
+		Tally* dst = new Tally(&nw);
+		Tally* src = new Tally(&nw);
+		Tally* caller = new Tally(&nw);
+		src->peers.add(dst);
+		caller->peers.add(dst);
+
+		const size_t N = 20000;
+		{
+			executor ex(&nw, 4);
+			for(size_t i=0; i<N; i++)
+				ex.post(src, [&]() { src->peers[dst].bump(); });
+
+			// two-way calls overlap the one-way calls on dst
+			size_t last = 0;
+			bool monotone = true;
+			for(size_t i=0; i<2000; i++) {
+				size_t h = caller->peers[dst].read();
+				if(h < last) monotone = false;
+				last = h;
+			}
+			TS_ASSERT(monotone);
+
+			ex.wait();
+			TS_ASSERT_EQUALS(caller->peers[dst].read(), N);
+		}
+		TS_ASSERT(! dst->overlapped);
+		TS_ASSERT_EQUALS(dst->count, N);
+
+		// two-way calls from tasks, with call-backs to the caller
+		const size_t K = 8;
+		vector<Tally*> S;
+		for(size_t i=0; i<K; i++) {
+			S.push_back(new Tally(&nw));
+			S[i]->peers.add(dst);
+			dst->peers.add(S[i]);
+		}
+		std::atomic<size_t> answers { 0 }, wrong { 0 };
+		{
+			executor ex(&nw, 4);
+			for(size_t r=0; r<1000; r++)
+				for(size_t i=0; i<K; i++)
+					ex.post(S[i], [&,i]() {
+						Tally* s = S[i];
+						s->count++;
+						s->peers[dst].bump();
+						if(s->peers[dst].ask(s) != s->count) wrong++;
+						answers++;
+					});
+			ex.wait();
+		}
+		TS_ASSERT_EQUALS(answers, 1000*K);
+		TS_ASSERT_EQUALS(wrong, 0);
+		TS_ASSERT(! dst->overlapped);
+		TS_ASSERT_EQUALS(dst->count, N+1000*K);
+		for(auto s : S) {
+			TS_ASSERT(! s->overlapped);
+			delete s;
+		}
+
+		delete caller;
+		delete src;
+		delete dst;
+	}
+
+
+	void test_fanout()
+	{
+		network nw;
+		const size_t N = 5000;
+		mcast_group<Relay> group(&nw);
+		vector<Relay*> R;
+		for(size_t i=0; i<N; i++) {
+			R.push_back(new Relay(&nw));
+			group.join(R.back());
+		}
+		Relay* src = new Relay(&nw);
+
+		{
+			fanout_pool pool(&nw, 3, 100);
+			TS_ASSERT_EQUALS(nw.fanout(), &pool);
+			TS_ASSERT(nw.sharded_counters());
+
+			src->relays[&group].pass(0);
+			src->relays[&group].pass(0);
+
+			// blocks cover the range exactly once, and errors
+			// are rethrown
+			vector<int> hit(N, 0);
+			pool.run(N, [&](size_t from, size_t to) {
+				for(size_t i=from; i<to; i++) hit[i]++;
+			});
+			TS_ASSERT_EQUALS(std::count(hit.begin(), hit.end(), 1), N);
+			TS_ASSERT_THROWS(pool.run(N, [&](size_t from, size_t to) {
+				if(from <= N/2 && N/2 < to) throw std::runtime_error("fail");
+			}), std::runtime_error);
+		}
+
+		// back-to-back runs, with pool threads waking late
+		{
+			fanout_pool pool(&nw, 8, 1);
+			std::atomic<size_t> total { 0 };
+			const size_t Runs = 200000;
+			for(size_t r=0; r<Runs; r++)
+				pool.run(2, [&](size_t from, size_t to) { total += to-from; });
+			TS_ASSERT_EQUALS(total, 2*Runs);
+		}
+		TS_ASSERT(nw.fanout() == nullptr);
+
+		for(auto r : R) {
+			TS_ASSERT_EQUALS(r->handled, 2);
+			TS_ASSERT(! r->overlapped);
+		}
+
+		chan_query q(nw);
+		TS_ASSERT_EQUALS(q.multicast().msgs(), 2);
+		TS_ASSERT_EQUALS(q.multicast().recv_msgs(), 2*N);
+		TS_ASSERT_EQUALS(q.multicast().recv_bytes(), 2*N*sizeof(int));
+
+		delete src;
+		for(auto r : R) delete r;
+	}
+
+
+	void test_simulator()
+	{
+		network nw;
+		const size_t N = 4;
+		vector<Relay*> R;
+		for(size_t i=0; i<N; i++)
+			R.push_back(new Relay(&nw));
+		for(size_t i=0; i<N; i++) {
+			R[i]->next = R[(i+1)%N];
+			R[i]->relays.add(R[i]->next);
+		}
+
+		simulator sim(&nw);
+		TS_ASSERT_EQUALS(nw.sim(), &sim);
+		auto lat = new linear_latency(5);
+		lat->set_latency(R[3]->relays[R[0]].pass.request_channel(), 10);
+		sim.set_latency(lat);
+
+		// a token going twice around the ring
+		R[0]->relays[R[1]].pass(7);
+		TS_ASSERT_EQUALS(R[1]->handled, 0);
+		TS_ASSERT_EQUALS(sim.pending(), 1);
+
+		sim.run_until(5);
+		TS_ASSERT_EQUALS(R[1]->handled, 1);
+		TS_ASSERT_EQUALS(sim.now(), 5);
+
+		TS_ASSERT_EQUALS(sim.run(), 7);
+		TS_ASSERT_EQUALS(sim.now(), 6*5 + 2*10);
+		TS_ASSERT_EQUALS(sim.processed(), 8);
+		TS_ASSERT_EQUALS(chan_frame(nw).msgs(), 8);
+
+		// events at equal times are processed in order
+		vector<int> order;
+		sim.after(3, [&]() { order.push_back(2); });
+		sim.after(1, [&]() { order.push_back(0); });
+		sim.after(3, [&]() { order.push_back(3); });
+		sim.after(1, [&]() { order.push_back(1); });
+		sim.after(1000, [&]() { order.push_back(4); });
+		sim.run();
+		TS_ASSERT_EQUALS(order.size(), 5);
+		for(int i=0; i<(int)order.size(); i++)
+			TS_ASSERT_EQUALS(order[i], i);
+		TS_ASSERT_THROWS(sim.at(0, [](){}), std::invalid_argument);
+
+		for(auto r : R) delete r;
+	}
+
+
+	void test_async_calls()
+	{
+		Echo_network nw;
+		simulator sim(&nw);
+		sim.set_latency(new linear_latency(10));
+
+		const size_t N = 100;
+		Echo_cli* cli = new Echo_cli(&nw);
+		vector<Echo*> srv;
+		vector<Echo_async_proxy*> prx;
+		for(size_t i=0; i<N; i++) {
+			srv.push_back(new Echo(&nw));
+			prx.push_back(new Echo_async_proxy(cli));
+			*prx.back() <<= srv.back();
+		}
+
+		chan_frame cf(nw);
+		task<int> t = fan_out(prx, 41);
+		TS_ASSERT(! t.done());
+		// all requests are charged at send time
+		TS_ASSERT_EQUALS(cf.endp_req().msgs(), N);
+		TS_ASSERT_EQUALS(cf.endp_rsp().msgs(), 0);
+		TS_ASSERT_EQUALS(sim.pending(), N);
+
+		sim.run();
+		TS_ASSERT(t.done());
+		TS_ASSERT_EQUALS(t.result(), 42*N);
+		// all calls were pipelined
+		TS_ASSERT_EQUALS(sim.now(), 20);
+		TS_ASSERT_EQUALS(cf.endp_rsp().msgs(), N);
+		TS_ASSERT_EQUALS(cf.endp_rsp().bytes(), N*sizeof(int));
+
+		// sequential calls, a NAK and a one-way call
+		vector<string> log;
+		ping_pong(prx[0], log);
+		sim.run();
+		TS_ASSERT_EQUALS(log.size(), 3);
+		TS_ASSERT_EQUALS(log[0], "Echoing a");
+		TS_ASSERT_EQUALS(log[1], "nak");
+		TS_ASSERT_EQUALS(log[2], "done");
+		TS_ASSERT_EQUALS(sim.now(), 20 + 10 + 10 + 10 + 10);
+		TS_ASSERT_EQUALS(srv[0]->value, -1);
+
+		for(auto p : prx) delete p;
+		for(auto s : srv) delete s;
+		delete cli;
+	}
+
+
+	void test_async_abandoned()
+	{
+		Echo_network nw;
+		Echo_cli* cli = new Echo_cli(&nw);
+		vector<Echo*> srv;
+		vector<Echo_async_proxy*> prx;
+		for(size_t i=0; i<4; i++) {
+			srv.push_back(new Echo(&nw));
+			prx.push_back(new Echo_async_proxy(cli));
+			*prx.back() <<= srv.back();
+		}
+
+		// destroyed with the requests in flight
+		vector<string> log;
+		task<int> t;
+		{
+			simulator sim(&nw);
+			t = fan_out(prx, 1);
+			ping_pong(prx[0], log);
+			TS_ASSERT_EQUALS(sim.pending(), 5);
+		}
+		TS_ASSERT(t.done());
+		TS_ASSERT_THROWS(t.result(), std::runtime_error);
+		TS_ASSERT(log.empty());
+		TS_ASSERT(nw.sim() == nullptr);
+
+		// destroyed with some responses in flight
+		{
+			simulator sim(&nw);
+			sim.set_latency(new linear_latency(10));
+			t = fan_out(prx, 1);
+			ping_pong(prx[0], log);
+			for(int i=0; i<5; i++) sim.step();
+			TS_ASSERT_EQUALS(sim.now(), 10);
+			TS_ASSERT_EQUALS(sim.pending(), 5);
+		}
+		TS_ASSERT(t.done());
+		TS_ASSERT_THROWS(t.result(), std::runtime_error);
+		TS_ASSERT(log.empty());
+
+		for(auto p : prx) delete p;
+		for(auto s : srv) delete s;
+		delete cli;
+	}
+
+
+	void test_windows()
+	{
+		Echo_network nw;
+		nw.set_windows(3);
+		TS_ASSERT_THROWS(nw.set_sharded_counters(true), std::logic_error);
+
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		const traffic_windows* tw = nw.windows();
+		channel* c = cli->proxy.add.request_channel();
+		TS_ASSERT(! tw->active(c->id()));
+
+		// epoch 0: 2 calls, epoch 1: none, epoch 2: 1 call, epoch 3: 3 calls
+		cli->proxy.add(1,2);
+		cli->proxy.add(1,2);
+		nw.tick();
+		nw.tick();
+		cli->proxy.add(1,2);
+		nw.tick();
+		for(int i=0;i<3;i++) cli->proxy.add(1,2);
+		TS_ASSERT_EQUALS(tw->epoch(), 3);
+		TS_ASSERT(tw->active(c->id()));
+
+		// epoch 0 is no longer retained
+		TS_ASSERT_EQUALS(tw->msgs(c->id(), 0), 0);
+		TS_ASSERT_EQUALS(tw->msgs(c->id(), 1), 0);
+		TS_ASSERT_EQUALS(tw->msgs(c->id(), 2), 1);
+		TS_ASSERT_EQUALS(tw->msgs(c->id(), 3), 3);
+		TS_ASSERT_EQUALS(tw->bytes(c->id(), 3), 6*sizeof(int));
+
+		chan_frame cf(nw);
+		TS_ASSERT_EQUALS(cf.msgs(), 12);
+		TS_ASSERT_EQUALS(cf.msgs(0, 4), 8);
+		TS_ASSERT_EQUALS(cf.msgs(3, 4), 6);
+		TS_ASSERT_EQUALS(cf.endp_req().bytes(2, 4), 8*sizeof(int));
+		chan_query q(nw);
+		TS_ASSERT_EQUALS(q.msgs(0, 4), 8);
+		TS_ASSERT_EQUALS(q.endp_rsp().msgs(2, 3), 1);
+
+		// a long idle period clears the old windows
+		for(int i=0;i<10;i++) nw.tick();
+		TS_ASSERT_EQUALS(cf.msgs(0, 100), 0);
+		cli->proxy.add(1,2);
+		TS_ASSERT_EQUALS(cf.msgs(0, 100), 2);
+
+		delete cli;
+		delete srv;
+	}
+
+
+	void test_trace()
+	{
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+
+		string path = "dsarch_test_trace.bin";
+		{
+			// a small buffer, to exercise the flusher
+			trace_writer tw(path, trace_stamp::sequence, 1, 64);
+			nw.set_trace(&tw);
+			TS_ASSERT_EQUALS(nw.trace(), &tw);
+			for(int i=0; i<100; i++)
+				cli->proxy.add(i, 1);
+			cli->proxy.echo("hello");
+			tw.close();
+			TS_ASSERT(nw.trace() == nullptr);
+			TS_ASSERT_EQUALS(tw.records(), 202);
+		}
+
+		trace_reader tr(path);
+		TS_ASSERT_EQUALS((int)tr.stamp_kind(), (int)trace_stamp::sequence);
+		trace_record rec;
+		size_t n = 0, bytes = 0;
+		channel* add_req = cli->proxy.add.request_channel();
+		channel* add_rsp = cli->proxy.add.response_channel();
+		while(tr.next(rec)) {
+			TS_ASSERT_EQUALS(rec.stamp, n);
+			if(n < 200)
+				TS_ASSERT_EQUALS(rec.cid, (n%2==0 ? add_req : add_rsp)->id());
+			bytes += rec.size;
+			n++;
+		}
+		TS_ASSERT_EQUALS(n, 202);
+		TS_ASSERT_EQUALS(bytes, chan_frame(nw).bytes());
+
+		// sampling one in ten transmissions
+		{
+			trace_writer tw(path, trace_stamp::sequence, 10);
+			nw.set_trace(&tw);
+			for(int i=0; i<50; i++)
+				cli->proxy.add(i, 1);
+		}
+		trace_reader ts(path);
+		n = 0;
+		while(ts.next(rec)) {
+			TS_ASSERT_EQUALS(rec.stamp, 10*n);
+			n++;
+		}
+		TS_ASSERT_EQUALS(n, 10);
+		std::remove(path.c_str());
+
+		// write errors are reported by close()
+		{
+			trace_writer tw("/dev/full", trace_stamp::sequence, 1, 64);
+			nw.set_trace(&tw);
+			for(int i=0; i<100; i++)
+				cli->proxy.add(i, 1);
+			TS_ASSERT_THROWS(tw.close(), std::runtime_error);
+		}
+
+		// a writer may outlive its network
+		{
+			trace_writer tw(path);
+			{
+				network tnw;
+				tnw.set_trace(&tw);
+			}
+			tw.close();
+		}
+		std::remove(path.c_str());
+
+		delete cli;
+		delete srv;
+	}
+
+
+	void test_snapshot()
+	{
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		srv->set_name("server");
+
+		TS_ASSERT_EQUALS( cli->send_echo("Hi"), "Echoing Hi" );
+		for(int i=0; i<10; i++)
+			cli->proxy.add(i, 1);
+
+		string path = "dsarch_test_snapshot.bin";
+		write_snapshot(nw, path);
+		{
+			snapshot snap(path);
+			chan_query live(nw);
+			chan_query q = snap.query();
+			TS_ASSERT(q.net() == nullptr);
+			TS_ASSERT_EQUALS(q.size(), live.size());
+			TS_ASSERT_EQUALS(q.msgs(), live.msgs());
+			TS_ASSERT_EQUALS(q.bytes(), live.bytes());
+			TS_ASSERT_EQUALS(q.src(srv->addr()).msgs(), live.src(srv).msgs());
+			TS_ASSERT_EQUALS(q.dst(srv->addr()).bytes(), live.dst(srv).bytes());
+			TS_ASSERT_EQUALS(q.endp("Echo", "add").msgs(), 20);
+			TS_ASSERT_EQUALS(q.endp_req().msgs(), live.endp_req().msgs());
+			TS_ASSERT_THROWS(q.frame(), std::logic_error);
+
+			// the protocol is restored with the same codes
+			TS_ASSERT_EQUALS(snap.rpc().code("Echo", "add"), nw.rpc().code("Echo", "add"));
+			TS_ASSERT_EQUALS(snap.rpc().ifaces.size(), nw.rpc().ifaces.size());
+
+			TS_ASSERT_EQUALS(snap.num_hosts(), nw.hosts().size() + nw.groups().size());
+			size_t i = snap.find(srv->addr());
+			TS_ASSERT_LESS_THAN(i, snap.num_hosts());
+			TS_ASSERT_EQUALS(snap.name(i), "server");
+			TS_ASSERT_EQUALS(snap.find(-12345), snap.num_hosts());
+		}
+
+		// corrupt files are rejected
+		auto patched = [&](size_t pos, uint64_t v) {
+			std::FILE* f = fopen(path.c_str(), "rb");
+			string buf(1<<20, '\0');
+			buf.resize(fread(&buf[0], 1, buf.size(), f));
+			fclose(f);
+			memcpy(&buf[pos], &v, sizeof(v));
+			string bad = "dsarch_test_snapshot_bad.bin";
+			f = fopen(bad.c_str(), "wb");
+			fwrite(buf.data(), 1, buf.size(), f);
+			fclose(f);
+			return bad;
+		};
+		uint64_t hdr[12];
+		{
+			std::FILE* f = fopen(path.c_str(), "rb");
+			TS_ASSERT_EQUALS(fread(hdr, 1, sizeof(hdr), f), sizeof(hdr));
+			fclose(f);
+		}
+		const uint64_t nhosts = hdr[3], hosts_off = hdr[8];
+		TS_ASSERT(nhosts >= 2);
+		const size_t offs = hosts_off + ((nhosts*sizeof(host_addr)+7) & ~7);
+		// a name offset out of order
+		string bad = patched(offs + sizeof(uint64_t), uint64_t(1) << 40);
+		TS_ASSERT_THROWS(snapshot s(bad), std::runtime_error);
+		// a host count whose section length wraps around
+		bad = patched(3*sizeof(uint64_t), nhosts + (uint64_t(1) << 62));
+		TS_ASSERT_THROWS(snapshot s(bad), std::runtime_error);
+		std::remove(bad.c_str());
+		std::remove(path.c_str());
+
+		TS_ASSERT_THROWS(snapshot("dsarch_no_such_snapshot.bin"), std::system_error);
+
+		delete cli;
+		delete srv;
+	}
+
+
+	void test_traffic_matrix()
+	{
+		Echo_network nw;
+		const size_t N = 6;
+		vector<Echo*> srv;
+		vector<Echo_cli*> cli;
+		for(size_t i=0; i<N; i++) {
+			srv.push_back(new Echo(&nw));
+			cli.push_back(new Echo_cli(&nw));
+		}
+		// client i calls servers i and i+1, i+1 times each
+		for(size_t i=0; i<N; i++)
+			for(size_t j=i; j<i+2 && j<N; j++) {
+				cli[i]->proxy <<= srv[j];
+				for(size_t k=0; k<=i; k++) cli[i]->proxy.add(1, 2);
+			}
+		cli[0]->proxy.say_bye("bye");
+
+		traffic_matrix tm(nw);
+		for(unsigned nthreads : { 1u, 3u }) {
+			traffic_matrix m(nw, 0, 0, nthreads);
+			TS_ASSERT(m.row_addr == tm.row_addr);
+			TS_ASSERT(m.row_ptr == tm.row_ptr);
+			TS_ASSERT(m.col == tm.col);
+			TS_ASSERT(m.msgs == tm.msgs);
+			TS_ASSERT(m.byts == tm.byts);
+		}
+		TS_ASSERT_EQUALS(tm.total_msgs(), chan_frame(nw).msgs());
+		TS_ASSERT_EQUALS(tm.total_bytes(), chan_frame(nw).bytes());
+		TS_ASSERT_EQUALS(tm.nnz(), 4*N-2);
+
+		// entries sum the channels of all endpoints between two hosts
+		host_addr c0 = cli[0]->addr(), s0 = srv[0]->addr();
+		size_t e = tm.find(c0, srv[1]->addr());
+		TS_ASSERT_LESS_THAN(e, tm.nnz());
+		TS_ASSERT_EQUALS(tm.msgs[e], 2);
+		TS_ASSERT_EQUALS(tm.byts[e], chan_frame(nw).src(cli[0]).dst(srv[1]).bytes());
+		TS_ASSERT_EQUALS(tm.find(s0, cli[5]->addr()), tm.nnz());
+		TS_ASSERT_EQUALS(tm.find(-1, s0), tm.nnz());
+		TS_ASSERT_EQUALS(tm.rows(), 2*N);
+		for(host_addr a : tm.row_addr)
+			TS_ASSERT(std::is_sorted(tm.col.begin()+tm.row_begin(a), 
+				tm.col.begin()+tm.row_end(a)));
+		TS_ASSERT_EQUALS(tm.row_end(c0) - tm.row_begin(c0), 2);
+		TS_ASSERT_EQUALS(tm.row_begin(-1), tm.row_end(-1));
+		TS_ASSERT_EQUALS(tm.row(-1), tm.rows());
+
+		// slices
+		traffic_matrix add(nw, nw.rpc().code("Echo", "add"), 
+			RPCC_IFC_MASK|RPCC_METH_MASK);
+		TS_ASSERT_EQUALS(add.total_msgs(), chan_frame(nw).endp("Echo","add").msgs());
+		TS_ASSERT_EQUALS(traffic_matrix(nw, "Echo").total_msgs(), tm.total_msgs());
+		TS_ASSERT_EQUALS(traffic_matrix(nw, "Nosuch").nnz(), 0);
+		{
+			// an unknown interface does not select channels without one
+			Echo_network rnw;
+			Echo* a = new Echo(&rnw);
+			Echo* b = new Echo(&rnw);
+			rnw.connect(a, b, 0)->transmit(8);
+			TS_ASSERT_EQUALS(traffic_matrix(rnw, 0, RPCC_IFC_MASK).nnz(), 1);
+			TS_ASSERT_EQUALS(traffic_matrix(rnw, "Nosuch").nnz(), 0);
+			TS_ASSERT_EQUALS(traffic_matrix(rnw, "Nosuch").rows(), 0);
+			delete a;
+			delete b;
+		}
+		{
+			// rows are kept only for sources, however sparse the addresses
+			Echo_network rnw;
+			Echo* a = new Echo(&rnw);
+			Echo* b = new Echo(&rnw);
+			TS_ASSERT(b->set_addr(100000000));
+			rnw.connect(b, a, 0)->transmit(8);
+			traffic_matrix sm(rnw);
+			TS_ASSERT_EQUALS(sm.rows(), 1);
+			TS_ASSERT_EQUALS(sm.row_ptr.size(), 2);
+			TS_ASSERT_EQUALS(sm.row_addr[0], 100000000);
+			TS_ASSERT_LESS_THAN(sm.find(100000000, a->addr()), sm.nnz());
+			TS_ASSERT_EQUALS(sm.find(a->addr(), 100000000), sm.nnz());
+			delete a;
+			delete b;
+		}
+
+		// files
+		string path = "dsarch_test_matrix.bin";
+		add.write(path);
+		traffic_matrix rd = traffic_matrix::read(path);
+		TS_ASSERT(rd.row_addr == add.row_addr);
+		TS_ASSERT(rd.row_ptr == add.row_ptr);
+		TS_ASSERT(rd.col == add.col);
+		TS_ASSERT(rd.msgs == add.msgs);
+		TS_ASSERT(rd.byts == add.byts);
+		TS_ASSERT_EQUALS(rd.code, add.code);
+		TS_ASSERT_EQUALS(rd.mask, add.mask);
+		std::remove(path.c_str());
+		TS_ASSERT_THROWS(traffic_matrix::read("dsarch_no_such_matrix.bin"), 
+			std::system_error);
+
+		// snapshots give the same matrix
+		write_snapshot(nw, path);
+		{
+			snapshot snap(path);
+			traffic_matrix sm(snap.columns());
+			TS_ASSERT(sm.row_addr == tm.row_addr);
+			TS_ASSERT(sm.col == tm.col);
+			TS_ASSERT(sm.msgs == tm.msgs);
+		}
+		std::remove(path.c_str());
+
+		for(auto h : cli) delete h;
+		for(auto h : srv) delete h;
+	}
+
+
+	void test_byte_sizes()
+	{
+		// fixed-size packs are sized at compile time
+		static_assert(all_fixed_byte_size<int, double, sender<Echo>, Ack>);
+		static_assert(! all_fixed_byte_size<int, string>);
+		static_assert(message_size(1, 2.0) == sizeof(int)+sizeof(double));
+		static_assert(static_message_size<std::array<double,4>, 
+			std::pair<int,float>, std::tuple<long,sender<Echo>>> 
+			== 4*sizeof(double) + sizeof(int)+sizeof(float) + sizeof(long));
+
+		std::vector<double> v(1000000);
+		TS_ASSERT_EQUALS(byte_size(v), 1000000*sizeof(double));
+		std::vector<string> vs { "a", "bb", "ccc" };
+		TS_ASSERT_EQUALS(byte_size(vs), 6);
+		std::vector<std::vector<int>> vv { {1,2}, {3} };
+		TS_ASSERT_EQUALS(byte_size(vv), 3*sizeof(int));
+
+		std::pair<string, int> p { "hello", 1 };
+		TS_ASSERT_EQUALS(byte_size(p), 5+sizeof(int));
+		std::tuple<int, string, std::vector<float>> t { 1, "ab", {1.f, 2.f} };
+		TS_ASSERT_EQUALS(byte_size(t), sizeof(int)+2+2*sizeof(float));
+
+		std::optional<string> o;
+		TS_ASSERT_EQUALS(byte_size(o), 0);
+		o = "abc";
+		TS_ASSERT_EQUALS(byte_size(o), 3);
+
+		TS_ASSERT_EQUALS(message_size(1, vs, o, wrap(v)), 
+			sizeof(int) + 6 + 3 + 1000000*sizeof(double));
+	}
+
+
+	void test_codecs()
+	{
+		// varints, with zigzag for signed values
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(0u), 1);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(127u), 1);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(128u), 2);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(-1), 1);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(-65), 2);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>((unsigned long)-1), 10);
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(1.0), sizeof(double));
+
+		// length prefixes
+		string s(200, 'x');
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(s), 202);
+		TS_ASSERT_EQUALS(encoded_size<fixed_codec>(s), 204);
+		std::vector<int> v { 1, 1000, -3 };
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(v), 1+1+2+1);
+		TS_ASSERT_EQUALS(encoded_size<fixed_codec>(v), 4+3*sizeof(int));
+		std::array<double,3> a;
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(a), 3*sizeof(double));
+		std::optional<int> o;
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(o), 1);
+		o = 5;
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(o), 2);
+		std::tuple<int, string, bool> t { 300, "ab", true };
+		TS_ASSERT_EQUALS(encoded_size<varint_codec>(t), 2+3+1);
+
+		// the network setting applies to remote calls
+		Echo_network nw;
+		Echo* srv = new Echo(&nw);
+		Echo_cli* cli = new Echo_cli(&nw);
+		cli->proxy <<= srv;
+		TS_ASSERT_EQUALS((int)nw.codec(), (int)wire_codec::estimate);
+		nw.set_codec(wire_codec::varint);
+
+		cli->proxy.add(1, 2);
+		TS_ASSERT_EQUALS(cli->proxy.add.request_channel()->bytes(), 2);
+		TS_ASSERT_EQUALS(cli->proxy.add.response_channel()->bytes(), 1);
+		cli->proxy.echo("Hi");
+		TS_ASSERT_EQUALS(cli->proxy.echo.request_channel()->bytes(), 3);
+		TS_ASSERT_EQUALS(cli->proxy.echo.response_channel()->bytes(), 11);
+
+		nw.set_codec(wire_codec::fixed);
+		cli->proxy.echo("Hi");
+		TS_ASSERT_EQUALS(cli->proxy.echo.request_channel()->bytes(), 3+6);
+
+		delete cli;
+		delete srv;
+	}
+
+
 	void test_rpc_channels()
 	{
 		Echo_network nw;
@@ -288,7 +1740,7 @@ public:
 		TS_ASSERT_EQUALS(chan.endp_rsp().size(), 5);
 
 		TS_ASSERT_EQUALS(cli->proxy._r_proc, srv);
-		TS_ASSERT_EQUALS(cli->proxy._r_calls.size(), 7);
+		TS_ASSERT_EQUALS(cli->proxy._r_size(), 7);
 
 		TS_ASSERT_EQUALS( cli->send_echo("Hi"), "Echoing Hi" );
 		// The above call executed
@@ -315,6 +1767,26 @@ public:
 		TS_ASSERT_EQUALS(chan.endp_req().msgs(), 9);
 		TS_ASSERT_EQUALS(chan.endp_rsp().msgs(), 5);
 
+		TS_ASSERT_EQUALS(channel_counters::sum(nw.counters().msgs), chan.msgs());
+		TS_ASSERT_EQUALS(channel_counters::sum(nw.counters().byts), chan.bytes());
+
+		// the columnar query agrees with the frame
+		chan_query q(nw);
+		TS_ASSERT_EQUALS(q.size(), chan.size());
+		TS_ASSERT_EQUALS(q.msgs(), chan.msgs());
+		TS_ASSERT_EQUALS(q.bytes(), chan.bytes());
+		TS_ASSERT_EQUALS(q.src(srv).size(), 5);
+		TS_ASSERT_EQUALS(q.dst(srv).msgs(), chan.dst(srv).msgs());
+		TS_ASSERT_EQUALS(q.src(srv).bytes(), chan.src(srv).bytes());
+		TS_ASSERT_EQUALS(q.endp_req().msgs(), 9);
+		TS_ASSERT_EQUALS(q.endp_rsp().msgs(), 5);
+		TS_ASSERT_EQUALS(q.endp("Echo", "send_int").msgs(), 
+			chan.endp("Echo", "send_int").msgs());
+		TS_ASSERT_EQUALS(q.endp("Echo", "send_int").size(), 2);
+		TS_ASSERT_EQUALS(q.endp(typeid(Echo)).size(), 12);
+		TS_ASSERT_EQUALS(q.src(srv).union_with(q.dst(srv)).size(), 12);
+		TS_ASSERT_EQUALS(q.except(q.src(srv)).frame().size(), 7);
+
 		delete cli;
 		delete srv;
 	}
@@ -349,6 +1821,11 @@ public:
 		TS_ASSERT_EQUALS(cf.unicast().msgs(), 1);
 		TS_ASSERT_EQUALS(cf.multicast().msgs(), 1);
 
+		Peer_proxy& mprx = P[0]->peermap[p2p.peers];
+		TS_ASSERT(mprx.is_multicast());
+		TS_ASSERT(mprx.proc() == nullptr);
+		TS_ASSERT_EQUALS(mprx.proc_group(), &p2p.peers);
+
 		P[0]->change_key(2);
 		P[1]->change_key(2);
 		P[2]->change_key(2);
@@ -362,6 +1839,57 @@ public:
 		TS_ASSERT_EQUALS(cf.multicast().msgs(), 4);
 		TS_ASSERT_EQUALS(cf.multicast().recv_msgs(), 12);
 
+		chan_query q(p2p);
+		TS_ASSERT_EQUALS(q.unicast().msgs(), 6);
+		TS_ASSERT_EQUALS(q.multicast().msgs(), 4);
+		TS_ASSERT_EQUALS(q.multicast().recv_msgs(), 12);
+		TS_ASSERT_EQUALS(q.recv_bytes(), cf.recv_bytes());
+
+		// membership
+		TS_ASSERT_EQUALS(p2p.peers.size(), 4);
+		TS_ASSERT_EQUALS(p2p.peers.receivers(P[0]), 3);
+		TS_ASSERT_EQUALS(p2p.peers.receivers(&p2p.all_hosts), 4);
+		p2p.peers.join(P[2]);
+		TS_ASSERT_EQUALS(p2p.peers.size(), 4);
+		p2p.peers.leave(P[1]);
+		TS_ASSERT(! p2p.peers.contains(P[1]));
+		TS_ASSERT(p2p.peers.contains(P[3]));
+		TS_ASSERT_EQUALS(p2p.peers.receivers(P[1]), 3);
+		TS_ASSERT_EQUALS(p2p.peers.receivers(P[3]), 2);
+		p2p.peers.leave(P[1]);
+		TS_ASSERT_EQUALS(p2p.peers.size(), 3);
+		std::set<Peer*> left(p2p.peers.begin(), p2p.peers.end());
+		TS_ASSERT(left == std::set<Peer*>({P[0], P[2], P[3]}));
+		p2p.peers.join(P[1]);
+		TS_ASSERT_EQUALS(p2p.peers.members().back(), P[1]);
+
+		// handlers can join the group during a multicast call
+		{
+			network rnw;
+			mcast_group<Recruiter> group(&rnw);
+			vector<std::unique_ptr<Recruiter>> R;
+			for(size_t i=0; i<4; i++) {
+				R.emplace_back(new Recruiter(&rnw));
+				group.join(R.back().get());
+			}
+			for(auto& r : R) { r->group = &group; r->recruits = &R; }
+			Recruiter src(&rnw);
+			src.group = &group;
+			src.recruits = &R;
+			src.peers[group].recruit(100);
+			TS_ASSERT_EQUALS(group.size(), 4+4*100);
+			for(size_t i=0; i<R.size(); i++)
+				TS_ASSERT_EQUALS(R[i]->called, i<4 ? 1 : 0);
+
+			// handlers can leave, and every member is still called
+			for(auto& r : R) r->called = 0;
+			src.peers[group].quit();
+			TS_ASSERT_EQUALS(group.size(), 0);
+			for(auto& r : R)
+				TS_ASSERT_EQUALS(r->called, 1);
+			R.clear();
+		}
+
 		for(auto&& p : P)
 			delete p;
 	}
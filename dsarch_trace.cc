@@ -0,0 +1,186 @@
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+
+#include "dsarch_trace.hh"
+
+namespace dsarch {
+
+using namespace std;
+
+static const char trace_magic[4] = { 'D', 'S', 'T', 'R' };
+static const uint8_t trace_version = 1;
+
+
+//-------------------
+//
+//  trace writer
+//
+//-------------------
+
+
+trace_writer::trace_writer(const string& path, trace_stamp stamp,
+	size_t sample_every, size_t buffer_size)
+: kind(stamp), sample(sample_every)
+{
+	if(sample == 0)
+		throw std::invalid_argument("sampling rate must be positive");
+	if(buffer_size < 4*max_varint)
+		throw std::invalid_argument("trace buffer too small");
+
+	file = fopen(path.c_str(), "wb");
+	if(file == nullptr)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open trace file " + path);
+
+	uint8_t header[8] = { 0 };
+	memcpy(header, trace_magic, 4);
+	header[4] = trace_version;
+	header[5] = uint8_t(kind);
+	failed = fwrite(header, 1, sizeof(header), file) != sizeof(header);
+
+	cur.reserve(buffer_size);
+	pending.reserve(buffer_size);
+	flusher = std::thread([this]() { run_flusher(); });
+}
+
+
+trace_writer::~trace_writer()
+{
+	// errors can only be reported by an explicit close()
+	try {
+		close();
+	} catch(std::runtime_error&) { }
+}
+
+
+void trace_writer::swap_buffers()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this]() { return ! flushing; });
+	std::swap(cur, pending);
+	cur.clear();
+	flushing = true;
+	cv.notify_all();
+}
+
+
+void trace_writer::run_flusher()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	while(true) {
+		cv.wait(lock, [this]() { return flushing || stopping; });
+		if(flushing) {
+			// write without holding the lock
+			lock.unlock();
+			bool ok = fwrite(pending.data(), 1, pending.size(), file) 
+				== pending.size();
+			lock.lock();
+			if(! ok) failed = true;
+			flushing = false;
+			cv.notify_all();
+		} else if(stopping)
+			return;
+	}
+}
+
+
+void trace_writer::close()
+{
+	if(file == nullptr) return;
+	if(nw != nullptr) nw->set_trace(nullptr);
+
+	if(! cur.empty())
+		swap_buffers();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	flusher.join();
+
+	if(fclose(file) != 0) failed = true;
+	file = nullptr;
+	if(failed)
+		throw std::runtime_error("error writing trace file");
+}
+
+
+
+//-------------------
+//
+//  trace reader
+//
+//-------------------
+
+
+trace_reader::trace_reader(const string& path, size_t buffer_size)
+: buf(buffer_size)
+{
+	file = fopen(path.c_str(), "rb");
+	if(file == nullptr)
+		throw std::system_error(errno, std::generic_category(),
+			"cannot open trace file " + path);
+
+	uint8_t header[8];
+	if(fread(header, 1, sizeof(header), file) != sizeof(header)
+		|| memcmp(header, trace_magic, 4) != 0) {
+		fclose(file);
+		throw std::runtime_error("not a trace file: " + path);
+	}
+	if(header[4] != trace_version) {
+		fclose(file);
+		throw std::runtime_error("unsupported trace version in " + path);
+	}
+	kind = trace_stamp(header[5]);
+}
+
+
+trace_reader::~trace_reader()
+{
+	fclose(file);
+}
+
+
+bool trace_reader::fill()
+{
+	// keep any unread bytes
+	memmove(buf.data(), buf.data()+pos, len-pos);
+	len -= pos;
+	pos = 0;
+	len += fread(buf.data()+len, 1, buf.size()-len, file);
+	return len > 0;
+}
+
+
+bool trace_reader::get_varint(uint64_t& v)
+{
+	v = 0;
+	for(int shift = 0; shift < 64; shift += 7) {
+		if(pos == len && ! fill())
+			return false;
+		uint8_t b = buf[pos++];
+		v |= uint64_t(b & 0x7f) << shift;
+		if((b & 0x80) == 0)
+			return true;
+	}
+	throw std::runtime_error("corrupt trace record");
+}
+
+
+bool trace_reader::next(trace_record& rec)
+{
+	uint64_t cid, delta, size;
+	if(! get_varint(cid))
+		return false;
+	if(! get_varint(delta) || ! get_varint(size))
+		throw std::runtime_error("truncated trace record");
+	last += delta;
+	rec.cid = cid;
+	rec.stamp = last;
+	rec.size = size;
+	return true;
+}
+
+
+} // end namespace dsarch
@@ -0,0 +1,179 @@
+/**
+	\file Binary message traces.
+
+	A message trace records every transmission on the channels of a
+	network, for offline analysis. Traces are written in a compact
+	binary format, by a background thread, so that tracing does not
+	slow down the simulation significantly.
+
+	The format of a trace file is a 8-byte header, followed by a
+	sequence of records. The header consists of the magic string
+	"DSTR", a version byte, the stamp kind byte (see \c trace_stamp)
+	and two reserved bytes. Each record consists of three LEB128 varints:
+	- the channel id
+	- the difference of the record's stamp from the previous record's
+	- the message size
+  */
+
+#pragma once
+
+#include <cstdio>
+
+#include "dsarch.hh"
+
+namespace dsarch {
+
+
+/**
+	The kind of stamp recorded with each message.
+  */
+enum class trace_stamp : uint8_t
+{
+	/// The sequence number of the transmission in the network
+	sequence = 0,
+	/// The virtual time of the network's simulator
+	time = 1
+};
+
+
+/**
+	A record of a trace.
+  */
+struct trace_record
+{
+	size_t cid;			///< the channel id
+	uint64_t stamp;		///< the sequence number or time
+	size_t size;		///< the message size
+};
+
+
+/**
+	Writes a binary trace of the transmissions of a network.
+
+	To trace a network, create a writer and pass it to
+	\c network::set_trace(). Records are appended to an in-memory buffer;
+	full buffers are written out to the file by a background thread,
+	while the simulation continues on a second buffer.
+
+	Optionally, only one in every \c N transmissions is recorded. The
+	sequence stamp still counts all transmissions.
+
+	Transmissions must be made from one thread at a time; tracing
+	cannot be combined with sharded counters.
+  */
+class trace_writer
+{
+public:
+	/**
+		Open a trace file for writing.
+
+		@param path the file path
+		@param stamp the kind of stamp to record
+		@param sample_every record one in this many transmissions
+		@param buffer_size the size of each of the two buffers
+	  */
+	trace_writer(const string& path, trace_stamp stamp = trace_stamp::sequence,
+		size_t sample_every = 1, size_t buffer_size = 1<<20);
+
+	/// Close the trace, if not already closed
+	~trace_writer();
+
+	/// The kind of stamp recorded
+	inline trace_stamp stamp_kind() const { return kind; }
+
+	/// The number of transmissions seen
+	inline uint64_t transmissions() const { return seq; }
+
+	/// The number of records written
+	inline uint64_t records() const { return nrecords; }
+
+	/**
+		Record a transmission.
+
+		This is called by \c channel::transmit() on traced networks.
+	  */
+	inline void record(size_t cid, size_t msg_size) {
+		uint64_t s = seq++;
+		if(sample > 1 && s % sample != 0) return;
+		if(kind == trace_stamp::time) s = nw->sim() ? nw->sim()->now() : 0;
+		if(cur.size() + 3*max_varint > cur.capacity()) swap_buffers();
+		put_varint(cid);
+		put_varint(s - last);
+		put_varint(msg_size);
+		last = s;
+		nrecords++;
+	}
+
+	/**
+		Write out all buffered records and close the file. Also
+		detaches the writer from its network. Throws 
+		\c std::runtime_error if any write to the file failed.
+	  */
+	void close();
+
+private:
+	static constexpr size_t max_varint = 10;
+
+	trace_stamp kind;
+	uint64_t sample;
+	uint64_t seq = 0;
+	uint64_t last = 0;
+	uint64_t nrecords = 0;
+	network* nw = nullptr;
+	std::FILE* file;
+	bool failed = false;	// a write failed, guarded by mtx
+
+	// double buffering with the flusher thread
+	vector<uint8_t> cur, pending;
+	bool flushing = false;
+	bool stopping = false;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::thread flusher;
+
+	inline void put_varint(uint64_t v) {
+		while(v >= 0x80) {
+			cur.push_back(uint8_t(v) | 0x80);
+			v >>= 7;
+		}
+		cur.push_back(uint8_t(v));
+	}
+
+	void swap_buffers();
+	void run_flusher();
+
+	friend class network;
+};
+
+
+/**
+	Reads a binary trace, record by record.
+  */
+class trace_reader
+{
+public:
+	/// Open a trace file for reading
+	trace_reader(const string& path, size_t buffer_size = 1<<20);
+	~trace_reader();
+
+	/// The kind of stamp in the trace
+	inline trace_stamp stamp_kind() const { return kind; }
+
+	/**
+		Read the next record. Returns false at the end of the trace.
+	  */
+	bool next(trace_record& rec);
+
+private:
+	std::FILE* file;
+	trace_stamp kind;
+	uint64_t last = 0;
+	vector<uint8_t> buf;
+	size_t pos = 0, len = 0;
+
+	bool fill();
+	bool get_varint(uint64_t& v);
+};
+
+
+} // end namespace dsarch
@@ -8,7 +8,14 @@
 
 #pragma once
 
-#include "dsarch_types.hh"
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <array>
+#include <utility>
+#include <tuple>
+#include <optional>
+#include <type_traits>
 
 namespace dsarch {
 
@@ -20,13 +27,49 @@ namespace dsarch {
   -----------------------------------*/
 
 
+/**
+	Trait for types whose byte size does not depend on the value.
+
+	For such types, \c fixed is true and \c value is the byte size.
+	Message sizes of arguments with fixed sizes are computed at compile
+	time. To declare a user type as fixed-size, specialize this trait
+	(deriving from \c byte_size_constant), or use \c BYTE_SIZE_SIZEOF.
+  */
+template <typename T, typename Enable = void>
+struct fixed_byte_size
+{
+	static constexpr bool fixed = false;
+	static constexpr size_t value = 0;
+};
+
+/// Base for specializations of \c fixed_byte_size
+template <size_t N>
+struct byte_size_constant
+{
+	static constexpr bool fixed = true;
+	static constexpr size_t value = N;
+};
+
+/// True if all types have fixed byte sizes
+template <typename...Ts>
+constexpr bool all_fixed_byte_size = (fixed_byte_size<Ts>::fixed && ...);
+
+/// The total byte size of a list of fixed-size types
+template <typename...Ts>
+constexpr size_t static_message_size = (fixed_byte_size<Ts>::value + ... + 0);
+
+
 /**
 	By default, types with a "byte_size" method are handled.
+	Types with a fixed byte size need not have such a method.
   */
 template <typename MsgType>
 size_t byte_size(const MsgType& m)
 {
-	return m.byte_size();
+	if constexpr (fixed_byte_size<MsgType>::fixed)
+		return fixed_byte_size<MsgType>::value;
+	else
+		return m.byte_size();
 }
 
 /**
@@ -40,6 +83,8 @@ inline size_t byte_size<std::string>(const std::string& s)
 
 #define BYTE_SIZE_SIZEOF(type)\
 template<>\
+struct fixed_byte_size<type> : byte_size_constant<sizeof(type)> {};\
+template<>\
 inline size_t byte_size<type>(const type& i) { return sizeof(type); }
 
 BYTE_SIZE_SIZEOF(int)
@@ -52,6 +97,85 @@ BYTE_SIZE_SIZEOF(float)
 BYTE_SIZE_SIZEOF(double)
 
 
+/*
+	Byte sizes of standard containers. An element sequence is
+	sized as the sum of its elements; sequences of fixed-size
+	elements are sized without iterating. Empty optionals have
+	zero size.
+  */
+
+template <typename T, size_t N>
+struct fixed_byte_size<std::array<T, N>, 
+	std::enable_if_t<fixed_byte_size<T>::fixed>>
+: byte_size_constant<N*fixed_byte_size<T>::value> {};
+
+template <typename A, typename B>
+struct fixed_byte_size<std::pair<A, B>, 
+	std::enable_if_t<all_fixed_byte_size<A, B>>>
+: byte_size_constant<static_message_size<A, B>> {};
+
+template <typename...Ts>
+struct fixed_byte_size<std::tuple<Ts...>, 
+	std::enable_if_t<all_fixed_byte_size<Ts...>>>
+: byte_size_constant<static_message_size<Ts...>> {};
+
+template <typename T, typename Alloc>
+size_t byte_size(const std::vector<T, Alloc>& v);
+template <typename T, size_t N>
+size_t byte_size(const std::array<T, N>& a);
+template <typename A, typename B>
+size_t byte_size(const std::pair<A, B>& p);
+template <typename...Ts>
+size_t byte_size(const std::tuple<Ts...>& t);
+template <typename T>
+size_t byte_size(const std::optional<T>& o);
+
+template <typename Seq>
+inline size_t __sequence_byte_size(const Seq& seq)
+{
+	typedef typename Seq::value_type T;
+	if constexpr (fixed_byte_size<T>::fixed)
+		return seq.size() * fixed_byte_size<T>::value;
+	else {
+		size_t total = 0;
+		for(const T& x : seq) total += byte_size(x);
+		return total;
+	}
+}
+
+template <typename T, typename Alloc>
+inline size_t byte_size(const std::vector<T, Alloc>& v)
+{
+	return __sequence_byte_size(v);
+}
+
+template <typename T, size_t N>
+inline size_t byte_size(const std::array<T, N>& a)
+{
+	return __sequence_byte_size(a);
+}
+
+template <typename A, typename B>
+inline size_t byte_size(const std::pair<A, B>& p)
+{
+	return byte_size(p.first) + byte_size(p.second);
+}
+
+template <typename...Ts>
+inline size_t byte_size(const std::tuple<Ts...>& t)
+{
+	return std::apply([](const Ts&...x) { 
+		return (size_t(0) + ... + byte_size(x)); 
+	}, t);
+}
+
+template <typename T>
+inline size_t byte_size(const std::optional<T>& o)
+{
+	return o ? byte_size(*o) : 0;
+}
+
+
 
 } // end namespace dsarch
 
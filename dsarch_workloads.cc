@@ -0,0 +1,491 @@
+/**
+	\file Reference workloads for end-to-end benchmarks.
+
+	Three protocols, in the style of typical dsarch simulations:
+
+	- \c gmon: geometric monitoring of the norm of the average of k
+	  local vectors. Sites check a local safe zone on every update,
+	  and report violations to a coordinator, which synchronizes all
+	  sites with two-way calls and a multicast. It also runs under an
+	  \c executor, as \c gmon_exec, where the coordinator's two-way
+	  calls are nested in its tasks.
+	- \c gossip: push-sum averaging, where in every round each host
+	  sends half its mass to a peer chosen uniformly among all hosts.
+	- \c tree: aggregation of a stream over a tree of fan-in 8; the root
+	  periodically collects partial aggregates with nested two-way calls.
+
+	Each workload is parameterized by the number of hosts and the
+	length of its stream (updates, rounds or items). Every run happens
+	in a child process, so that its peak RSS is measured in isolation.
+	The driver reports the calls per second of the stream phase, and,
+	as metrics, the wall time including setup and teardown, the peak
+	RSS and the final \c chan_frame totals.
+  */
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <memory>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dsarch_bench.hh"
+
+using namespace dsarch;
+using namespace dsarch::bench;
+
+
+/**
+	The result of a single workload run.
+  */
+struct outcome
+{
+	double setup = 0, run = 0, wall = 0;
+	size_t calls = 0, channels = 0, msgs = 0, bytes = 0, recv_msgs = 0;
+	size_t rss_kb = 0;
+	// a workload-specific sanity value
+	double check = 0;
+};
+
+
+// collect the network totals, after the stream phase
+static void tally(outcome& out, const network& nw)
+{
+	chan_frame cf(nw);
+	out.channels = cf.size();
+	out.calls = cf.endp_req().msgs();
+	out.msgs = cf.msgs();
+	out.bytes = cf.bytes();
+	out.recv_msgs = cf.recv_msgs();
+}
+
+
+
+/*---- Geometric monitoring ----*/
+
+namespace gmon {
+
+constexpr size_t dim = 4;
+typedef std::array<double, dim> point;
+
+// the monitored threshold on the norm of the global average
+constexpr double threshold = 1.2;
+
+inline double norm(const point& p)
+{
+	double s = 0;
+	for(double x : p) s += x*x;
+	return std::sqrt(s);
+}
+
+struct Site;
+struct Site_proxy;
+struct Estimate_proxy;
+
+struct Coordinator : host
+{
+	proxy_map<Site_proxy, Site> sites;
+	proxy_map<Estimate_proxy, Site> bcast;
+	mcast_group<Site> group;
+	size_t syncs = 0;
+
+	Coordinator(network* nw) : host(nw), sites(this), bcast(this), group(nw) {}
+
+	oneway violation(sender<Site> site);
+};
+
+struct Coord_proxy : remote_proxy<Coordinator>
+{
+	REMOTE_METHOD(Coordinator, violation);
+	Coord_proxy(host* owner) : remote_proxy<Coordinator>(owner) {}
+};
+
+struct Site : host
+{
+	Coord_proxy coord;
+	point x {}, ref {}, estimate {};
+
+	Site(network* nw, Coordinator* c) : host(nw), coord(this) { coord <<= c; }
+
+	// a local update, checking the safe zone
+	void update(const point& item);
+
+	point state() { return x; }
+	oneway new_estimate(point e) { estimate = e; ref = x; }
+};
+
+struct Site_proxy : remote_proxy<Site>
+{
+	REMOTE_METHOD(Site, state);
+	Site_proxy(host* owner) : remote_proxy<Site>(owner) {}
+};
+
+// multicast proxies cannot have two-way methods
+struct Estimate_proxy : remote_proxy<Site>
+{
+	REMOTE_METHOD(Site, new_estimate);
+	Estimate_proxy(host* owner) : remote_proxy<Site>(owner) {}
+};
+
+void Site::update(const point& item)
+{
+	x = item;
+	// the ball spanned by the estimate and the local drift must not
+	// cross the threshold surface
+	point c;
+	double r = 0;
+	for(size_t i = 0; i < dim; i++) {
+		double d = x[i] - ref[i];
+		c[i] = estimate[i] + d/2;
+		r += d*d;
+	}
+	r = std::sqrt(r)/2;
+	if(std::abs(norm(c) - threshold) <= r)
+		coord.violation(this);
+}
+
+oneway Coordinator::violation(sender<Site>)
+{
+	syncs++;
+	point avg {};
+	for(Site* s : group) {
+		point p = sites[s].state();
+		for(size_t i = 0; i < dim; i++) avg[i] += p[i];
+	}
+	for(double& a : avg) a /= group.size();
+	bcast[group].new_estimate(avg);
+}
+
+// with threads > 0, the updates are posted to the sites, and run by 
+// an executor
+outcome run(size_t k, size_t len, unsigned threads = 0)
+{
+	outcome out;
+	stopwatch wall;
+	{
+		network nw;
+		Coordinator* coord = new Coordinator(&nw);
+		vector<Site*> S;
+		for(size_t i = 0; i < k; i++) {
+			S.push_back(new Site(&nw, coord));
+			coord->group.join(S.back());
+		}
+		coord->sites.add_sites(S);
+		coord->bcast[coord->group];
+
+		// the norm of the average makes one slow oscillation below the 
+		// threshold; syncs are rare, and due mostly to noise
+		std::mt19937_64 rng(k);
+		std::normal_distribution<double> noise(0.0, 0.04);
+		auto item = [&](size_t t) {
+			double m = 0.9 + 0.1*std::sin(2*M_PI*t/len);
+			point p;
+			for(auto& v : p) v = m/std::sqrt(double(dim)) + noise(rng);
+			return p;
+		};
+
+		// the initial estimate
+		for(auto s : S) s->x = item(0);
+		S[0]->coord.violation(S[0]);
+		out.setup = wall.elapsed();
+
+		stopwatch sw;
+		if(threads == 0) {
+			for(size_t t = 0; t < len; t++)
+				S[rng() % k]->update(item(t));
+		} else {
+			executor ex(&nw, threads);
+			for(size_t t = 0; t < len; t++) {
+				Site* s = S[rng() % k];
+				ex.post(s, [s, p = item(t)]() { s->update(p); });
+			}
+			ex.wait();
+		}
+		out.run = sw.elapsed();
+		out.check = coord->syncs;
+
+		tally(out, nw);
+		for(auto s : S) delete s;
+		delete coord;
+	}
+	out.wall = wall.elapsed();
+	return out;
+}
+
+} // end namespace gmon
+
+
+
+/*---- All-to-all gossip ----*/
+
+namespace gossip {
+
+struct Peer_proxy;
+
+struct Peer : host
+{
+	double s, w = 1.0;
+	// proxies to the peers contacted so far, created on first contact
+	proxy_map<Peer_proxy, Peer> peers;
+
+	Peer(network* nw, double value) : host(nw), s(value), peers(this) {}
+
+	oneway push(double ds, double dw) { s += ds; w += dw; }
+
+	// one round of push-sum
+	void round(Peer* to);
+};
+
+struct Peer_proxy : remote_proxy<Peer>
+{
+	REMOTE_METHOD(Peer, push);
+	Peer_proxy(host* owner) : remote_proxy<Peer>(owner) {}
+};
+
+void Peer::round(Peer* to)
+{
+	s /= 2;
+	w /= 2;
+	peers[to].push(s, w);
+}
+
+outcome run(size_t n, size_t rounds)
+{
+	outcome out;
+	stopwatch wall;
+	{
+		network nw;
+		vector<Peer*> P;
+		for(size_t i = 0; i < n; i++)
+			P.push_back(new Peer(&nw, double(i)));
+		out.setup = wall.elapsed();
+
+		stopwatch sw;
+		std::mt19937_64 rng(n);
+		for(size_t r = 0; r < rounds; r++)
+			for(size_t i = 0; i < n; i++) {
+				size_t j = rng() % (n-1);
+				P[i]->round(P[j < i ? j : j+1]);
+			}
+		out.run = sw.elapsed();
+
+		// the largest error of the local estimates of the average
+		double avg = (n-1)/2.0;
+		for(auto p : P)
+			out.check = std::max(out.check, std::abs(p->s/p->w - avg)/avg);
+
+		tally(out, nw);
+		for(auto p : P) delete p;
+	}
+	out.wall = wall.elapsed();
+	return out;
+}
+
+} // end namespace gossip
+
+
+
+/*---- Aggregation tree ----*/
+
+namespace tree {
+
+constexpr size_t fanin = 8;
+
+typedef std::pair<double, size_t> partial;
+
+struct Node_proxy;
+
+struct Node : host
+{
+	vector<std::unique_ptr<Node_proxy>> children;
+	partial local { 0.0, 0 };
+
+	Node(network* nw) : host(nw) {}
+
+	void observe(double x) { local.first += x; local.second++; }
+
+	// the partial aggregate of the subtree, since the last collection
+	partial collect();
+};
+
+struct Node_proxy : remote_proxy<Node>
+{
+	REMOTE_METHOD(Node, collect);
+	Node_proxy(host* owner) : remote_proxy<Node>(owner) {}
+};
+
+partial Node::collect()
+{
+	partial ret = local;
+	local = partial(0.0, 0);
+	for(auto& c : children) {
+		partial p = c->collect();
+		ret.first += p.first;
+		ret.second += p.second;
+	}
+	return ret;
+}
+
+outcome run(size_t n, size_t len)
+{
+	outcome out;
+	stopwatch wall;
+	{
+		network nw;
+		vector<Node*> T;
+		for(size_t i = 0; i < n; i++)
+			T.push_back(new Node(&nw));
+		for(size_t i = 1; i < n; i++) {
+			Node* parent = T[(i-1)/fanin];
+			parent->children.emplace_back(new Node_proxy(parent));
+			*parent->children.back() <<= T[i];
+		}
+		out.setup = wall.elapsed();
+
+		// a hundred collections over the stream
+		stopwatch sw;
+		std::mt19937_64 rng(n);
+		std::uniform_real_distribution<double> value(0.0, 1.0);
+		const size_t epoch = std::max<size_t>(len/100, 1);
+		size_t total = 0;
+		for(size_t t = 1; t <= len; t++) {
+			T[rng() % n]->observe(value(rng));
+			if(t % epoch == 0 || t == len)
+				total += T[0]->collect().second;
+		}
+		out.run = sw.elapsed();
+		out.check = total;
+
+		tally(out, nw);
+		for(auto h : T) delete h;
+	}
+	out.wall = wall.elapsed();
+	return out;
+}
+
+} // end namespace tree
+
+
+
+/*---- Driver ----*/
+
+
+/**
+	Run a workload in a child process, and collect its outcome.
+  */
+template <typename Func>
+static outcome isolated(Func&& func)
+{
+	int fd[2];
+	if(pipe(fd) != 0)
+		throw std::runtime_error("cannot create pipe");
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid < 0)
+		throw std::runtime_error("cannot fork");
+	if(pid == 0) {
+		close(fd[0]);
+		outcome out = func();
+		out.rss_kb = peak_rss_kb();
+		bool ok = write(fd[1], &out, sizeof(out)) == sizeof(out);
+		_exit(ok ? 0 : 1);
+	}
+
+	close(fd[1]);
+	outcome out;
+	bool ok = read(fd[0], &out, sizeof(out)) == sizeof(out);
+	close(fd[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	if(! ok || ! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		throw std::runtime_error("workload run failed");
+	return out;
+}
+
+
+static const char* workload_usage =
+	"  --workload NAME   gmon, gmon_exec, gossip, tree or all (default all)\n"
+	"  --threads N       the executor threads of gmon_exec (default: the\n"
+	"                    hardware concurrency)\n"
+	"  --hosts N         run only with N hosts\n"
+	"  --stream L        the stream length: updates (gmon, default 10^6),\n"
+	"                    rounds (gossip, default 10) or items (tree,\n"
+	"                    default 10^6)\n";
+
+
+int main(int argc, char** argv)
+{
+	options opts;
+	opts.max_scale = 100000;
+	opts.repeat = 1;
+	string workload = "all";
+	size_t stream = 0;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+	try {
+		if(argc == 2 && strcmp(argv[1], "--help") == 0) {
+			printf("usage: %s [options]\n%s%s", argv[0], options::usage,
+				workload_usage);
+			return 0;
+		}
+		opts.parse(argc, argv, [&](const string& opt, const string& val) {
+			if(opt == "--workload") workload = val;
+			else if(opt == "--hosts") opts.min_scale = opts.max_scale = std::stoul(val);
+			else if(opt == "--stream") stream = std::stoul(val);
+			else if(opt == "--threads") threads = std::stoul(val);
+			else return false;
+			return true;
+		});
+		if(workload != "all" && workload != "gmon" && workload != "gmon_exec"
+				&& workload != "gossip" && workload != "tree")
+			throw std::invalid_argument("unknown workload " + workload);
+		if(threads == 0)
+			throw std::invalid_argument("at least one thread is needed");
+		if(opts.min_scale < 2)
+			throw std::invalid_argument("at least two hosts are needed");
+	} catch(std::invalid_argument& e) {
+		fprintf(stderr, "%s: %s\nusage: %s [options]\n%s%s", argv[0], e.what(),
+			argv[0], options::usage, workload_usage);
+		return 2;
+	}
+
+	// the scales are exact host counts, not only powers of 10
+	vector<size_t> scales = opts.scales();
+	if(opts.min_scale == opts.max_scale)
+		scales = { opts.min_scale };
+
+	report rep(opts);
+	auto bench = [&](const string& name, size_t deflen, 
+			const std::function<outcome(size_t, size_t)>& run) {
+		if(workload != "all" && workload != name) return;
+		size_t len = stream ? stream : deflen;
+		for(size_t n : scales) {
+			vector<std::pair<measurement, report::metrics>> runs;
+			for(unsigned r = 0; r < opts.repeat; r++) {
+				outcome out = isolated([&]() { return run(n, len); });
+				runs.push_back({ measurement { out.calls, out.run }, {
+					{ "stream", double(len) },
+					{ "setup_s", out.setup },
+					{ "wall_s", out.wall },
+					{ "peak_rss_kb", double(out.rss_kb) },
+					{ "channels", double(out.channels) },
+					{ "msgs", double(out.msgs) },
+					{ "bytes", double(out.bytes) },
+					{ "recv_msgs", double(out.recv_msgs) },
+					{ "check", out.check },
+					{ "threads", double(name == "gmon_exec" ? threads : 0) } } });
+			}
+			rep.add(name, n, "calls", runs);
+		}
+	};
+
+	bench("gmon", 1000000, [](size_t k, size_t len) { return gmon::run(k, len); });
+	bench("gmon_exec", 1000000, [&](size_t k, size_t len) { 
+		return gmon::run(k, len, threads); 
+	});
+	bench("gossip", 10, gossip::run);
+	bench("tree", 1000000, tree::run);
+	rep.write_json();
+	return 0;
+}